@@ -0,0 +1,239 @@
+#include "../lib/bench.h"
+#include "../lib/bmp.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_REPETITIONS 64
+#define INPUT_FILE "bench-input.bmp"
+#define OUTPUT_FILE "bench-output.bmp"
+#define ENCODED_FILE "bench-encoded.bmp"
+
+static const char HELP_MESSAGE[] =
+    "Usage: bmp-bench [-r <repetitions>] [-d <directory>] <bmp-steganography> <synthetic> [<megapixels>...]\n"
+    "\n"
+    "Generates random, gradient and noise images of every size (1 10 50 100 200 megapixels by default)\n"
+    "and runs each mode of bmp-steganography on them, printing one CSV line per mode, pattern and size.\n"
+    "Time is the median of repetitions, syscalls are read and write calls taken from /proc/<pid>/io\n"
+    "(page faults of mapped files are not syscalls and do not show up there)";
+
+static const char *PATTERNS[] = {"random", "gradient", "noise"};
+static const double DEFAULT_SIZES[] = {1, 10, 50, 100, 200};
+
+static const char MESSAGE[] = "The quick brown fox jumps over the lazy dog, then benchmarks the bitmap.";
+
+typedef struct Mode
+{
+    char *name;
+    // Answer to the interactive prompt, modes with an output file do not ask
+    char *input;
+    char *arguments[5];
+} Mode;
+
+typedef struct Run
+{
+    double seconds;
+    uint64_t syscalls;
+    long peakKib;
+    int status;
+} Run;
+
+typedef struct Sample
+{
+    double seconds[MAX_REPETITIONS];
+    uint64_t syscalls;
+    long peakKib;
+} Sample;
+
+// Read and write syscalls of a finished child that has not been reaped yet
+uint64_t countSyscalls(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    FILE *io = fopen(path, "r");
+    if (!io)
+        return 0;
+
+    uint64_t syscalls = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), io))
+    {
+        unsigned long long value;
+        if (sscanf(line, "syscr: %llu", &value) == 1 || sscanf(line, "syscw: %llu", &value) == 1)
+            syscalls += value;
+    }
+    fclose(io);
+    return syscalls;
+}
+
+Run execute(char *const arguments[], const char *input)
+{
+    Run run = {0};
+    int feed[2];
+    if (pipe(feed))
+    {
+        run.status = -1;
+        return run;
+    }
+
+    double start = benchNow();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(feed[0], STDIN_FILENO);
+        close(feed[0]);
+        close(feed[1]);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execv(arguments[0], arguments);
+        _exit(127);
+    }
+
+    close(feed[0]);
+    // A short write would leave the prompt without its answer and time the wrong thing
+    bool fed = !input || write(feed[1], input, strlen(input)) == (ssize_t)strlen(input);
+    close(feed[1]);
+
+    siginfo_t info;
+    waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+    run.seconds = benchNow() - start;
+    run.syscalls = countSyscalls(pid);
+
+    struct rusage usage;
+    wait4(pid, &run.status, 0, &usage);
+    if (!fed)
+        run.status = -1;
+    run.peakKib = usage.ru_maxrss;
+    return run;
+}
+
+int main(int argc, char *argv[])
+{
+    int repetitions = 3;
+    char *directory = ".";
+
+    int option;
+    while ((option = getopt(argc, argv, "r:d:")) != -1)
+    {
+        if (option == 'r' && atoi(optarg) > 0 && atoi(optarg) <= MAX_REPETITIONS)
+            repetitions = atoi(optarg);
+        else if (option == 'd')
+            directory = optarg;
+        else
+        {
+            fprintf(stderr, "%s\n", HELP_MESSAGE);
+            return 1;
+        }
+    }
+
+    if (argc - optind < 2)
+    {
+        fprintf(stderr, "%s\n", HELP_MESSAGE);
+        return 1;
+    }
+
+    char *steganography = realpath(argv[optind], NULL);
+    char *synthetic = realpath(argv[optind + 1], NULL);
+    if (!steganography || !synthetic || chdir(directory))
+    {
+        fprintf(stderr, "Failed to locate the binaries or the working directory\n");
+        return 1;
+    }
+
+    size_t sizeCount;
+    double *sizes = benchSizes(argv + optind + 2, argc - optind - 2, DEFAULT_SIZES, sizeof(DEFAULT_SIZES) / sizeof(*DEFAULT_SIZES), &sizeCount);
+    if (!sizes)
+    {
+        fprintf(stderr, "Failed to allocate memory for the sizes\n");
+        return 1;
+    }
+
+    Mode modes[] = {
+        {"histogram", "h\n", {steganography, INPUT_FILE}},
+        {"grayscale", NULL, {steganography, INPUT_FILE, OUTPUT_FILE}},
+        {"grayscale8", NULL, {steganography, "-8", INPUT_FILE, OUTPUT_FILE}},
+        {"encode", NULL, {steganography, INPUT_FILE, ENCODED_FILE, (char *)MESSAGE}},
+        {"decode", "d\n", {steganography, ENCODED_FILE}},
+    };
+
+    printf("mode,pattern,megapixels,width,height,median_s,min_s,mb_per_s,megapixels_per_s,syscalls,peak_rss_kib\n");
+
+    for (size_t s = 0; s < sizeCount; s++)
+    {
+        // 4:3 images with odd widths, so rows always carry padding
+        uint32_t width = (uint32_t)sqrt(sizes[s] * 1e6 * 4 / 3) | 1;
+        uint32_t height = ceil(sizes[s] * 1e6 / width);
+        double megabytes = bmpRowLength(width, BMP_BGR24) * (double)height / 1e6;
+
+        char widthArgument[16], heightArgument[16];
+        snprintf(widthArgument, sizeof(widthArgument), "%u", width);
+        snprintf(heightArgument, sizeof(heightArgument), "%u", height);
+
+        for (size_t p = 0; p < sizeof(PATTERNS) / sizeof(*PATTERNS); p++)
+        {
+            char *generate[] = {synthetic, (char *)PATTERNS[p], widthArgument, heightArgument, INPUT_FILE, NULL};
+            if (execute(generate, NULL).status)
+            {
+                fprintf(stderr, "Failed to generate %s image of %u x %u\n", PATTERNS[p], width, height);
+                free(sizes);
+                free(steganography);
+                free(synthetic);
+                return 1;
+            }
+
+            for (size_t m = 0; m < sizeof(modes) / sizeof(*modes); m++)
+            {
+                Sample sample = {0};
+                for (int r = 0; r < repetitions; r++)
+                {
+                    Run run = execute(modes[m].arguments, modes[m].input);
+                    if (run.status)
+                    {
+                        fprintf(stderr, "%s failed on %s image of %u x %u\n", modes[m].name, PATTERNS[p], width, height);
+                        free(sizes);
+                        free(steganography);
+                        free(synthetic);
+                        return 1;
+                    }
+                    sample.seconds[r] = run.seconds;
+                    sample.syscalls = run.syscalls;
+                    if (run.peakKib > sample.peakKib)
+                        sample.peakKib = run.peakKib;
+                }
+
+                BenchSummary summary;
+                benchSummarize(sample.seconds, repetitions, &summary);
+                double median = summary.median;
+                printf("%s,%s,%.2f,%u,%u,%.6f,%.6f,%.1f,%.2f,%llu,%ld\n",
+                       modes[m].name,
+                       PATTERNS[p],
+                       (double)width * height / 1e6,
+                       width,
+                       height,
+                       median,
+                       summary.minimum,
+                       megabytes / median,
+                       (double)width * height / 1e6 / median,
+                       (unsigned long long)sample.syscalls,
+                       sample.peakKib);
+                fflush(stdout);
+            }
+        }
+
+        unlink(INPUT_FILE);
+        unlink(OUTPUT_FILE);
+        unlink(ENCODED_FILE);
+    }
+
+    free(sizes);
+    free(steganography);
+    free(synthetic);
+    return 0;
+}
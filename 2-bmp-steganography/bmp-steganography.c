@@ -1,53 +1,49 @@
-#include <math.h>
+#include "../lib/bmp.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-typedef uint16_t WORD;
-typedef uint32_t DWORD;
-typedef int32_t LONG;
+#define DEFAULT_MEMORY_LIMIT (64 << 20)
 
-typedef struct tagBITMAPFILEHEADER
-{
-    WORD bfType;
-    DWORD bfSize;
-    WORD bfReserved1;
-    WORD bfReserved2;
-    DWORD bfOffBits;
-} BITMAPFILEHEADER;
-
-typedef struct tagBITMAPINFOHEADER
+typedef struct Hist16Bins
 {
-    DWORD biSize;
-    LONG biWidth;
-    LONG biHeight;
-    WORD biPlanes;
-    WORD biBitCount;
-    DWORD biCompression;
-    DWORD biSizeImage;
-    LONG biXPelsPerMeter;
-    LONG biYPelsPerMeter;
-    DWORD biClrUsed;
-    DWORD biClrImportant;
-} BITMAPINFOHEADER;
+    char *name;
+    uint_fast32_t bins[16];
+} Hist16Bins;
 
 typedef struct Refs
 {
-    FILE *input;
-    FILE *output;
+    int input;
+    int output;
     char *textToEncode;
-    BITMAPINFOHEADER infoHeader;
-    uint_fast32_t rowLength;
-    uint_fast32_t maxEncodingLength;
+    bool indexed;
+    BmpHeaders headers;
+    // Layout of pixel data on both ends, memory is attached by mapping or streaming
+    BmpImage source;
+    BmpImage target;
+    off_t targetOffset;
+    uint_fast64_t maxEncodingLength;
+    uint_fast64_t memoryLimit;
+    // State carried over between row windows
+    uint_fast64_t bits;
+    char *decoded;
+    Hist16Bins histograms[3];
 } Refs;
 
 void freeRefs(Refs *refs)
 {
-    if (refs->input)
-        fclose(refs->input);
-    if (refs->output)
-        fclose(refs->output);
+    if (refs->input >= 0)
+        close(refs->input);
+    if (refs->output >= 0)
+        close(refs->output);
+    free(refs->decoded);
 }
 
 void throw(char *error, Refs *refs)
@@ -57,30 +53,6 @@ void throw(char *error, Refs *refs)
     exit(1);
 }
 
-void initFileHeader(BITMAPFILEHEADER *header, FILE *stream)
-{
-    fread(&header->bfType, 2, 1, stream);
-    fread(&header->bfSize, 4, 1, stream);
-    fread(&header->bfReserved1, 2, 1, stream);
-    fread(&header->bfReserved2, 2, 1, stream);
-    fread(&header->bfOffBits, 4, 1, stream);
-}
-
-void initInfoHeader(BITMAPINFOHEADER *header, FILE *stream)
-{
-    fread(&header->biSize, 4, 1, stream);
-    fread(&header->biWidth, 4, 1, stream);
-    fread(&header->biHeight, 4, 1, stream);
-    fread(&header->biPlanes, 2, 1, stream);
-    fread(&header->biBitCount, 2, 1, stream);
-    fread(&header->biCompression, 4, 1, stream);
-    fread(&header->biSizeImage, 4, 1, stream);
-    fread(&header->biXPelsPerMeter, 4, 1, stream);
-    fread(&header->biYPelsPerMeter, 4, 1, stream);
-    fread(&header->biClrUsed, 4, 1, stream);
-    fread(&header->biClrImportant, 4, 1, stream);
-}
-
 void printFileHeader(BITMAPFILEHEADER *header)
 {
     printf("BITMAPFILEHEADER:\n"
@@ -125,12 +97,6 @@ void printInfoHeader(BITMAPINFOHEADER *header)
            header->biClrImportant);
 }
 
-typedef struct Hist16Bins
-{
-    char *name;
-    uint_fast32_t bins[16];
-} Hist16Bins;
-
 void printHist16Bins(Hist16Bins *hist)
 {
     printf("%s:\n", hist->name);
@@ -149,134 +115,392 @@ void printHist16Bins(Hist16Bins *hist)
     }
 }
 
-void histogram(Refs *refs)
+typedef struct Stream
 {
-    Hist16Bins histBlue = {"Blue", {0}};
-    Hist16Bins histGreen = {"Green", {0}};
-    Hist16Bins histRed = {"Red", {0}};
+    int fd;
+    bool writing;
+    off_t offset;
+    // Layout of rows moved through the windows
+    BmpImage layout;
+    uint32_t rowsLeft;
+    uint32_t windowRows;
+    uint8_t *windows[2];
+    uint32_t rows[2];
+    off_t offsets[2];
+    // Window is owned by the I/O thread until it finishes reading or writing it
+    bool busy[2];
+    uint_fast8_t slot;
+    bool stop;
+    bool failed;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Stream;
+
+// Background thread keeping one window in flight while the other one is being transformed
+void *streamWorker(void *arg)
+{
+    Stream *stream = arg;
 
-    for (LONG y = 0; y < refs->infoHeader.biHeight; y++)
+    for (uint_fast8_t slot = 0;; slot ^= 1)
     {
-        for (LONG x = 0; x < refs->infoHeader.biWidth; x++)
-        {
-            uint_fast8_t blue, green, red;
+        pthread_mutex_lock(&stream->lock);
+        while (!stream->busy[slot] && !stream->stop)
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        bool stop = stream->stop;
+        pthread_mutex_unlock(&stream->lock);
 
-            fread(&blue, 1, 1, refs->input);
-            fread(&green, 1, 1, refs->input);
-            fread(&red, 1, 1, refs->input);
+        if (stop)
+            break;
 
-            histBlue.bins[blue / 16]++;
-            histGreen.bins[green / 16]++;
-            histRed.bins[red / 16]++;
-        }
-        for (uint_fast8_t p = 0; p < refs->rowLength - refs->infoHeader.biWidth * 3; p++)
+        if (!stream->writing)
         {
-            fseek(refs->input, 1, SEEK_CUR);
+            // Rows of the previous window in this slot have been consumed by now
+            if (stream->rows[slot])
+                posix_fadvise(stream->fd, stream->offsets[slot], stream->rows[slot] * stream->layout.stride, POSIX_FADV_DONTNEED);
+
+            stream->rows[slot] = stream->rowsLeft < stream->windowRows ? stream->rowsLeft : stream->windowRows;
+            stream->rowsLeft -= stream->rows[slot];
         }
+
+        uint32_t rows = stream->rows[slot];
+        size_t bytes = (size_t)rows * stream->layout.stride;
+        bool failed = stream->failed || !bmpTransfer(stream->fd, stream->windows[slot], bytes, stream->offset, stream->writing);
+
+        stream->offsets[slot] = stream->offset;
+        stream->offset += bytes;
+
+        pthread_mutex_lock(&stream->lock);
+        stream->failed = failed;
+        // Failed read is reported as the end of data
+        if (failed && !stream->writing)
+            stream->rows[slot] = 0;
+        stream->busy[slot] = false;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+
+        // Empty window marks the end of data in both directions
+        if (!rows || (failed && !stream->writing))
+            break;
     }
 
-    printHist16Bins(&histBlue);
-    printHist16Bins(&histGreen);
-    printHist16Bins(&histRed);
+    return NULL;
 }
 
-void grayscale(Refs *refs)
+bool streamOpen(Stream *stream, int fd, bool writing, off_t offset, const BmpImage *layout, uint32_t windowRows)
 {
-    for (LONG y = 0; y < refs->infoHeader.biHeight; y++)
+    *stream = (Stream){.fd = fd,
+                       .writing = writing,
+                       .offset = offset,
+                       .layout = *layout,
+                       .rowsLeft = layout->height,
+                       .windowRows = windowRows,
+                       .busy = {!writing, !writing}};
+
+    for (uint_fast8_t i = 0; i < 2; i++)
     {
-        for (LONG x = 0; x < refs->infoHeader.biWidth; x++)
-        {
-            uint_fast8_t blue, green, red;
+        stream->windows[i] = malloc((size_t)windowRows * layout->stride);
+        if (!stream->windows[i])
+            return false;
+    }
 
-            fread(&blue, 1, 1, refs->input);
-            fread(&green, 1, 1, refs->input);
-            fread(&red, 1, 1, refs->input);
+    if (!writing)
+        posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
 
-            uint8_t grayscale = red * 0.299 + green * 0.587 + blue * 0.114;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->changed, NULL);
+    return pthread_create(&stream->thread, NULL, streamWorker, stream) == 0;
+}
 
-            fwrite(&grayscale, 1, 1, refs->output);
-            fwrite(&grayscale, 1, 1, refs->output);
-            fwrite(&grayscale, 1, 1, refs->output);
-        }
-        for (uint_fast8_t p = 0; p < refs->rowLength - refs->infoHeader.biWidth * 3; p++)
+// Waits for the current window: filled with rows when reading, free for new rows when writing
+BmpImage streamAcquire(Stream *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    while (stream->busy[stream->slot])
+        pthread_cond_wait(&stream->changed, &stream->lock);
+    pthread_mutex_unlock(&stream->lock);
+
+    BmpImage window = stream->layout;
+    window.base = stream->windows[stream->slot];
+    window.height = stream->writing ? stream->windowRows : stream->rows[stream->slot];
+    return window;
+}
+
+// Hands the current window back to the I/O thread, with the number of rows to write when writing
+void streamRelease(Stream *stream, uint32_t rows)
+{
+    pthread_mutex_lock(&stream->lock);
+    if (stream->writing)
+        stream->rows[stream->slot] = rows;
+    stream->busy[stream->slot] = true;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+
+    stream->slot ^= 1;
+}
+
+bool streamClose(Stream *stream)
+{
+    if (stream->writing)
+    {
+        // Flush pending windows and let the writer exit on an empty one
+        streamAcquire(stream);
+        streamRelease(stream, 0);
+    }
+    else
+    {
+        pthread_mutex_lock(&stream->lock);
+        stream->stop = true;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+    }
+
+    pthread_join(stream->thread, NULL);
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->changed);
+    free(stream->windows[0]);
+    free(stream->windows[1]);
+    return !stream->failed;
+}
+
+// Transforms pixel data window by window until the action asks to stop
+typedef bool (*Action)(Refs *refs, const BmpImage *source, BmpImage *target);
+
+void runStreamed(Refs *refs, Action action)
+{
+    bool writing = refs->output >= 0;
+
+    // Two windows per direction have to fit into the memory limit
+    uint_fast64_t rowBytes = 2 * refs->source.stride + (writing ? 2 * refs->target.stride : 0);
+    uint_fast64_t windowRows = refs->memoryLimit / rowBytes;
+    if (windowRows < 1)
+        windowRows = 1;
+    if (windowRows > refs->source.height)
+        windowRows = refs->source.height;
+
+    Stream input, output;
+    if (!streamOpen(&input, refs->input, false, refs->headers.file.bfOffBits, &refs->source, windowRows))
+        throw("Failed to start reading image data", refs);
+    if (writing && !streamOpen(&output, refs->output, true, refs->targetOffset, &refs->target, windowRows))
+        throw("Failed to start writing image data", refs);
+
+    bool proceed = true;
+    while (proceed)
+    {
+        BmpImage source = streamAcquire(&input);
+        if (!source.height)
+            break;
+
+        BmpImage target = writing ? streamAcquire(&output) : (BmpImage){0};
+        target.height = source.height;
+        proceed = action(refs, &source, writing ? &target : NULL);
+
+        streamRelease(&input, 0);
+        if (writing)
+            streamRelease(&output, source.height);
+    }
+
+    bool read = streamClose(&input);
+    bool written = !writing || streamClose(&output);
+    if (!read && proceed)
+        throw("Failed to read image data", refs);
+    if (!written)
+        throw("Failed to write image data", refs);
+}
+
+// Whole pixel data is transformed in place of the files without any copies,
+// false when either of them cannot be mapped, like pipes
+bool runMapped(Refs *refs, Action action)
+{
+    bool writing = refs->output >= 0;
+    BmpImage source = refs->source;
+    BmpImage target = refs->target;
+
+    if (!bmpMap(&source, refs->input, refs->headers.file.bfOffBits, false))
+        return false;
+    if (writing && !bmpMap(&target, refs->output, refs->targetOffset, true))
+    {
+        bmpUnmap(&source, refs->headers.file.bfOffBits);
+        return false;
+    }
+
+    action(refs, &source, writing ? &target : NULL);
+
+    bmpUnmap(&source, refs->headers.file.bfOffBits);
+    if (writing)
+        bmpUnmap(&target, refs->targetOffset);
+    return true;
+}
+
+void run(Refs *refs, Action action)
+{
+    uint_fast64_t mapped = bmpDataLength(&refs->source) + (refs->output >= 0 ? bmpDataLength(&refs->target) : 0);
+    if (mapped > refs->memoryLimit || !runMapped(refs, action))
+        runStreamed(refs, action);
+}
+
+bool histogram(Refs *refs, const BmpImage *source, BmpImage *target)
+{
+    (void)target;
+
+    for (uint32_t y = 0; y < source->height; y++)
+    {
+        const uint8_t *pixel = bmpRow(source, y);
+        for (uint32_t x = 0; x < source->width; x++, pixel += 3)
         {
-            uint_fast8_t padding;
-            fread(&padding, 1, 1, refs->input);
-            fwrite(&padding, 1, 1, refs->output);
+            refs->histograms[0].bins[pixel[0] / 16]++;
+            refs->histograms[1].bins[pixel[1] / 16]++;
+            refs->histograms[2].bins[pixel[2] / 16]++;
         }
     }
+    return true;
 }
 
-void encode(Refs *refs)
+uint8_t toGray(uint_fast8_t blue, uint_fast8_t green, uint_fast8_t red)
 {
-    uint_fast32_t bits = 0;
-    uint_fast8_t value;
+    return red * 0.299 + green * 0.587 + blue * 0.114;
+}
 
-    for (LONG y = 0; y < refs->infoHeader.biHeight; y++)
+bool grayscale(Refs *refs, const BmpImage *source, BmpImage *target)
+{
+    (void)refs;
+
+    size_t pixelBytes = (size_t)source->width * 3;
+    for (uint32_t y = 0; y < source->height; y++)
     {
-        for (uint_fast32_t b = 0; b < refs->rowLength; b++)
+        const uint8_t *pixel = bmpRow(source, y);
+        uint8_t *gray = bmpRow(target, y);
+        for (uint32_t x = 0; x < source->width; x++, pixel += 3, gray += 3)
         {
-            uint8_t bit = bits % 8;
-            uint8_t byte = bits / 8;
-            fread(&value, 1, 1, refs->input);
-            // Modify least significant bit while there is data to encode
-            if (byte == 0 || refs->textToEncode[byte - 1] != '\0' || bit != 0)
-            {
-                // Get particular bit of text
-                if ((refs->textToEncode[byte] & (1 << bit)) >> bit)
-                    // Set least significant bit to 1
-                    value |= 0X01;
-                else
-                    // Set least significant bit to 0
-                    value &= 0XFE;
-                bits++;
-            }
-            fwrite(&value, 1, 1, refs->output);
+            gray[0] = gray[1] = gray[2] = toGray(pixel[0], pixel[1], pixel[2]);
         }
+        // Padding is carried over as is
+        memcpy(gray, pixel, bmpRowLength(source->width, source->format) - pixelBytes);
     }
+    return true;
 }
 
-void decode(Refs *refs)
+// Single byte per pixel indexing a 256-entry gray palette instead of three equal channels
+bool grayscaleIndexed(Refs *refs, const BmpImage *source, BmpImage *target)
 {
-    char *decoded = malloc(refs->maxEncodingLength + 1);
-    decoded[refs->maxEncodingLength] = '\0';
-
-    uint_fast32_t bits = 0;
-    uint_fast8_t value;
+    (void)refs;
 
-    for (LONG y = 0; y < refs->infoHeader.biHeight; y++)
+    size_t padding = bmpRowLength(target->width, target->format) - target->width;
+    for (uint32_t y = 0; y < source->height; y++)
     {
-        for (uint_fast32_t b = 0; b < refs->rowLength; b++)
+        const uint8_t *pixel = bmpRow(source, y);
+        uint8_t *gray = bmpRow(target, y);
+        for (uint32_t x = 0; x < source->width; x++, pixel += 3)
         {
-            uint8_t bit = bits % 8;
-            uint8_t byte = bits / 8;
-            fread(&value, 1, 1, refs->input);
-            // Set decoded bits unless '\0' is met
-            if (byte != 0 && decoded[byte - 1] == '\0')
-                break;
-            // Get least significant bit from image
-            if (value & 0X01)
-                // Set bit to 1
-                decoded[byte] |= 1 << bit;
-            else
-                // Set bit to 0
-                decoded[byte] &= ~(1 << bit);
-            bits++;
+            gray[x] = toGray(pixel[0], pixel[1], pixel[2]);
         }
+        memset(gray + target->width, 0, padding);
+    }
+    return true;
+}
+
+bool encode(Refs *refs, const BmpImage *source, BmpImage *target)
+{
+    // Rows are contiguous, so padding bytes carry bits as well
+    size_t length = source->stride * source->height;
+    memcpy(target->base, source->base, length);
+
+    for (size_t b = 0; b < length; b++)
+    {
+        uint_fast8_t bit = refs->bits % 8;
+        uint_fast64_t byte = refs->bits / 8;
+        // Modify least significant bit while there is data to encode
+        if (byte != 0 && refs->textToEncode[byte - 1] == '\0' && bit == 0)
+            break;
+        // Get particular bit of text
+        if ((refs->textToEncode[byte] & (1 << bit)) >> bit)
+            // Set least significant bit to 1
+            target->base[b] |= 0X01;
+        else
+            // Set least significant bit to 0
+            target->base[b] &= 0XFE;
+        refs->bits++;
+    }
+    return true;
+}
+
+bool decode(Refs *refs, const BmpImage *source, BmpImage *target)
+{
+    (void)target;
+
+    size_t length = source->stride * source->height;
+    char *decoded = refs->decoded;
+
+    for (size_t b = 0; b < length; b++)
+    {
+        uint_fast8_t bit = refs->bits % 8;
+        uint_fast64_t byte = refs->bits / 8;
+        // Set decoded bits unless '\0' is met, no need to read further
+        if ((byte != 0 && decoded[byte - 1] == '\0') || byte == refs->maxEncodingLength)
+            return false;
+        // Get least significant bit from image
+        if (source->base[b] & 0X01)
+            // Set bit to 1
+            decoded[byte] |= 1 << bit;
+        else
+            // Set bit to 0
+            decoded[byte] &= ~(1 << bit);
+        refs->bits++;
     }
+    return true;
+}
+
+void writeIndexedHeaders(Refs *refs)
+{
+    BmpHeaders headers;
+    bmpInitHeaders(&headers, &refs->target);
+    headers.info.biXPelsPerMeter = refs->headers.info.biXPelsPerMeter;
+    headers.info.biYPelsPerMeter = refs->headers.info.biYPelsPerMeter;
+
+    if (!bmpWriteHeaders(refs->output, &headers, BMP_GRAY8))
+        throw("Failed to write headers", refs);
+    refs->targetOffset = headers.file.bfOffBits;
+}
+
+void copyHeaders(Refs *refs)
+{
+    void *headers = malloc(refs->headers.file.bfOffBits);
 
-    printf("%s\n", decoded);
-    free(decoded);
+    if (!headers)
+        throw("Failed to allocate memory for new file headers", refs);
+
+    bool copied = bmpTransfer(refs->input, headers, refs->headers.file.bfOffBits, 0, false) &&
+                  bmpTransfer(refs->output, headers, refs->headers.file.bfOffBits, 0, true);
+    free(headers);
+
+    if (!copied)
+        throw("Failed to copy headers", refs);
+    refs->targetOffset = refs->headers.file.bfOffBits;
 }
 
 int main(int argc, char *argv[])
 {
-    Refs refs = {};
+    Refs refs = {.input = -1,
+                 .output = -1,
+                 .memoryLimit = DEFAULT_MEMORY_LIMIT,
+                 .histograms = {{"Blue", {0}}, {"Green", {0}}, {"Red", {0}}}};
 
     char *inputPath = NULL;
     char *outputPath = NULL;
 
-    switch (argc)
+    int option;
+    while ((option = getopt(argc, argv, "8m:")) != -1)
+    {
+        if (option == '8')
+            refs.indexed = true;
+        else if (option == 'm' && atoll(optarg) > 0)
+            refs.memoryLimit = (uint_fast64_t)atoll(optarg) << 20;
+        else
+            throw("Supported flags: -8 (8-bit palettized grayscale output), -m <MiB> (memory limit for pixel data)", &refs);
+    }
+    argv += optind - 1;
+
+    switch (argc - optind + 1)
     {
     case 4:
         refs.textToEncode = argv[3];
@@ -291,36 +515,53 @@ int main(int argc, char *argv[])
         throw("Expected at least 1 and no more than 3 arguments", &refs);
     }
 
+    if (refs.indexed && (!outputPath || refs.textToEncode))
+        throw("8-bit output is only available for grayscale conversion", &refs);
+
     char mode = outputPath ? (refs.textToEncode ? 'e' : 'g') : '\0';
 
-    refs.input = fopen(inputPath, "r");
-    if (!refs.input)
+    refs.input = open(inputPath, O_RDONLY);
+    if (refs.input < 0)
         throw("Failed to open input file", &refs);
 
     if (outputPath)
     {
-        refs.output = fopen(outputPath, "w");
-        if (!refs.output)
+        // Read and write access is needed to map the output
+        refs.output = open(outputPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (refs.output < 0)
             throw("Failed to open output file", &refs);
     }
 
-    BITMAPFILEHEADER fileHeader;
-    initFileHeader(&fileHeader, refs.input);
-    printFileHeader(&fileHeader);
+    if (!bmpReadHeaders(refs.input, &refs.headers))
+        throw("Input file is not a bitmap", &refs);
+    printFileHeader(&refs.headers.file);
 
-    if (fileHeader.bfType != 0x4D42)
+    if (refs.headers.file.bfType != BMP_FILE_TYPE)
         throw("Input file is not a bitmap", &refs);
 
-    initInfoHeader(&refs.infoHeader, refs.input);
-    printInfoHeader(&refs.infoHeader);
+    printInfoHeader(&refs.headers.info);
 
-    if (refs.infoHeader.biBitCount != 24 || refs.infoHeader.biCompression != 0)
+    const char *error = bmpValidate(&refs.headers, &refs.source);
+    if (error)
+        throw((char *)error, &refs);
+    if (refs.source.format != BMP_BGR24)
         throw("Further operations are only supported for uncompressed 24-bit files", &refs);
 
-    refs.rowLength = ceil(24 * refs.infoHeader.biWidth / 32) * 4;
-    refs.maxEncodingLength = refs.rowLength * (refs.infoHeader.biHeight);
+    struct stat input;
+    if (fstat(refs.input, &input) || input.st_size < (off_t)(refs.headers.file.bfOffBits + bmpDataLength(&refs.source)))
+        throw("Pixel data is truncated", &refs);
+
+    refs.target = refs.source;
+    if (refs.indexed)
+    {
+        refs.target.format = BMP_GRAY8;
+        refs.target.stride = bmpRowLength(refs.target.width, BMP_GRAY8);
+    }
+
+    // Every byte of pixel data carries a single bit, text is followed by '\0'
+    refs.maxEncodingLength = bmpDataLength(&refs.source) / 8;
 
-    if (refs.textToEncode && strlen(refs.textToEncode) > refs.maxEncodingLength)
+    if (refs.textToEncode && strlen(refs.textToEncode) + 1 > refs.maxEncodingLength)
         throw("Image is too small to contain the whole text", &refs);
 
     if (!mode)
@@ -334,38 +575,45 @@ int main(int argc, char *argv[])
             return 0;
         }
 
-        fseek(refs.input, fileHeader.bfOffBits, SEEK_SET);
         printf("\n");
     }
+    else if (refs.indexed)
+        writeIndexedHeaders(&refs);
     else
-    {
-        fseek(refs.input, 0, SEEK_SET);
-        void *headers = malloc(fileHeader.bfOffBits);
+        copyHeaders(&refs);
 
-        if (!headers)
-            throw("Failed to allocate memory for new file headers", &refs);
-
-        fread(headers, fileHeader.bfOffBits, 1, refs.input);
-        fwrite(headers, fileHeader.bfOffBits, 1, refs.output);
-        free(headers);
-    }
-
-    void (*action)(Refs *);
+    Action action;
     if (mode == 'h')
         action = histogram;
     else if (mode == 'g')
-        action = grayscale;
+        action = refs.indexed ? grayscaleIndexed : grayscale;
     else if (mode == 'e')
         action = encode;
     else if (mode == 'd')
+    {
         action = decode;
+        refs.decoded = calloc(refs.maxEncodingLength + 1, 1);
+        if (!refs.decoded)
+            throw("Failed to allocate memory for decoded text", &refs);
+    }
     else
     {
         fprintf(stderr, "%c", mode);
         throw(" - mode is not supported", &refs);
     }
 
-    action(&refs);
+    run(&refs, action);
+
+    if (mode == 'h')
+    {
+        printHist16Bins(&refs.histograms[0]);
+        printHist16Bins(&refs.histograms[1]);
+        printHist16Bins(&refs.histograms[2]);
+    }
+    else if (mode == 'd')
+    {
+        printf("%s\n", refs.decoded);
+    }
 
     freeRefs(&refs);
     return 0;
@@ -0,0 +1,278 @@
+#include "../../lib/bench.h"
+#include "../../lib/bmp.h"
+#include "../mandelbrot/mandelbrot.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_REPETITIONS 64
+#define MAX_VALUES 16
+#define OUTPUT_FILE "bench-mandelbrot.bmp"
+
+static const char HELP_MESSAGE[] =
+    "Usage: mandelbrot-bench [-r <repetitions>] [-d <directory>] [-i <limit>,...] [-j <threads>,...] <mandelbrot> [<megapixels>...]\n"
+    "\n"
+    "Renders every scene at every size (0.25 1 4 megapixels by default, 3:2 like the default view),\n"
+    "iteration limit (500 and 5000 by default) and thread count (1 and all cores by default),\n"
+    "each once per pixel and once with subdivision (-s 4),\n"
+    "printing one CSV line per combination. Time is the render time reported by mandelbrot -v, median\n"
+    "of repetitions with its relative standard deviation. The checksum is FNV-1a of the pixels; a scene\n"
+    "whose checksum changes between repetitions or thread counts is reported and fails the run";
+
+typedef struct BenchScene
+{
+    const char *name;
+    const char *centerRe;
+    const char *centerIm;
+    const char *zoom;
+} BenchScene;
+
+static const BenchScene SCENES[] = {
+    {"full", "-0.5", "0", "1"},
+    // Spirals between the cardioid and the period-2 bulb, boundary almost everywhere
+    {"seahorse", "-0.7453", "0.1127", "150"},
+    // Period-3 bulb, which the cardioid and period-2 tests do not catch, so only cycle detection saves work
+    {"interior", "-0.122", "0.745", "16"},
+    // Upper right of the set, nearly all pixels escape within a few iterations
+    {"exterior", "0.4", "1.0", "2"},
+};
+static const double DEFAULT_SIZES[] = {0.25, 1, 4};
+// Minimum rectangle of the subdivision mode, 0 evaluates every pixel
+static const char *SUBDIVISIONS[] = {"0", "4"};
+static const long DEFAULT_LIMITS[] = {500, 5000};
+
+typedef struct Run
+{
+    double seconds;
+    uint64_t iterations;
+    int status;
+} Run;
+
+// Runs mandelbrot -v and takes render time and iterations from its report
+static Run execute(char *const arguments[])
+{
+    Run run = {.status = -1};
+    int report[2];
+    if (pipe(report))
+        return run;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(report[1], STDOUT_FILENO);
+        close(report[0]);
+        close(report[1]);
+        execv(arguments[0], arguments);
+        _exit(127);
+    }
+    close(report[1]);
+
+    char output[4096];
+    size_t length = 0;
+    ssize_t bytes;
+    while (pid > 0 && (bytes = read(report[0], output + length, sizeof(output) - 1 - length)) > 0)
+    {
+        length += bytes;
+    }
+    output[length] = '\0';
+    close(report[0]);
+    if (pid < 0 || waitpid(pid, &run.status, 0) < 0)
+        return run;
+
+    unsigned long long iterations = 0;
+    const char *line = strstr(output, "Iterations: ");
+    if (sscanf(output, "Rendered in %lf s", &run.seconds) != 1 || !line || sscanf(line, "Iterations: %llu", &iterations) != 1)
+        run.status = run.status ? run.status : -1;
+    run.iterations = iterations;
+    return run;
+}
+
+// FNV-1a of the pixel rows without padding, so that only the rendered values count
+static bool checksumImage(const char *path, uint64_t *checksum)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    BmpHeaders headers;
+    BmpImage image;
+    bool mapped = bmpReadHeaders(fd, &headers) && !bmpValidate(&headers, &image) && bmpMap(&image, fd, headers.file.bfOffBits, false);
+    close(fd);
+    if (!mapped)
+        return false;
+
+    uint64_t hash = 14695981039346656037ULL;
+    size_t rowBytes = (size_t)image.width * bmpBitCount(image.format) / 8;
+    for (uint32_t y = 0; y < image.height; y++)
+    {
+        const uint8_t *row = bmpRow(&image, y);
+        for (size_t x = 0; x < rowBytes; x++)
+        {
+            hash = (hash ^ row[x]) * 1099511628211ULL;
+        }
+    }
+    bmpUnmap(&image, headers.file.bfOffBits);
+    *checksum = hash;
+    return true;
+}
+
+// Comma-separated positive numbers, returns how many were read or 0 for a malformed list
+static size_t parseList(const char *text, long *values)
+{
+    size_t count = 0;
+    char *end;
+    do
+    {
+        long value = strtol(text, &end, 10);
+        if (end == text || value < 1 || count == MAX_VALUES)
+            return 0;
+        values[count++] = value;
+        text = end + 1;
+    } while (*end == ',');
+    return *end ? 0 : count;
+}
+
+int main(int argc, char *argv[])
+{
+    int repetitions = 3;
+    char *directory = ".";
+    long limits[MAX_VALUES], threads[MAX_VALUES];
+    size_t limitCount = sizeof(DEFAULT_LIMITS) / sizeof(*DEFAULT_LIMITS);
+    memcpy(limits, DEFAULT_LIMITS, sizeof(DEFAULT_LIMITS));
+    // Single thread and every core, which is the same thing on a single core
+    threads[0] = 1;
+    threads[1] = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threadCount = threads[1] > 1 ? 2 : 1;
+
+    int option;
+    while ((option = getopt(argc, argv, "r:d:i:j:")) != -1)
+    {
+        if (option == 'r' && atoi(optarg) > 0 && atoi(optarg) <= MAX_REPETITIONS)
+            repetitions = atoi(optarg);
+        else if (option == 'd')
+            directory = optarg;
+        else if (option == 'i' && (limitCount = parseList(optarg, limits)))
+            continue;
+        else if (option == 'j' && (threadCount = parseList(optarg, threads)))
+            continue;
+        else
+        {
+            fprintf(stderr, "%s\n", HELP_MESSAGE);
+            return 1;
+        }
+    }
+
+    if (argc - optind < 1)
+    {
+        fprintf(stderr, "%s\n", HELP_MESSAGE);
+        return 1;
+    }
+
+    char *mandelbrot = realpath(argv[optind], NULL);
+    if (!mandelbrot || chdir(directory))
+    {
+        fprintf(stderr, "Failed to locate the binary or the working directory\n");
+        return 1;
+    }
+
+    size_t sizeCount;
+    double *sizes = benchSizes(argv + optind + 1, argc - optind - 1, DEFAULT_SIZES, sizeof(DEFAULT_SIZES) / sizeof(*DEFAULT_SIZES), &sizeCount);
+    if (!sizes)
+    {
+        fprintf(stderr, "Failed to allocate memory for the sizes\n");
+        return 1;
+    }
+
+    printf("scene,subdivision,width,height,max_iterations,threads,median_s,min_s,relative_stddev,megapixels_per_s,giga_iterations_per_s,checksum\n");
+
+    bool consistent = true;
+    for (size_t c = 0; c < sizeof(SCENES) / sizeof(*SCENES); c++)
+    {
+        const BenchScene *scene = &SCENES[c];
+        for (size_t s = 0; s < sizeCount; s++)
+        {
+            // One more than a multiple of the subdivision tile, so the last tile column is a single pixel wide
+            uint32_t tiles = round(sqrt(sizes[s] * 1e6 * 3 / 2) / SUBDIVISION_TILE);
+            uint32_t width = (tiles ? tiles : 1) * SUBDIVISION_TILE + 1;
+            uint32_t height = ceil(sizes[s] * 1e6 / width);
+            char widthArgument[16], heightArgument[16];
+            snprintf(widthArgument, sizeof(widthArgument), "%u", width);
+            snprintf(heightArgument, sizeof(heightArgument), "%u", height);
+
+            for (size_t l = 0; l < limitCount; l++)
+            {
+                char limitArgument[16];
+                snprintf(limitArgument, sizeof(limitArgument), "%ld", limits[l]);
+                for (size_t m = 0; m < sizeof(SUBDIVISIONS) / sizeof(*SUBDIVISIONS); m++)
+                {
+                    // Every thread count has to give the image of the first run
+                    uint64_t expected = 0;
+                    bool first = true;
+
+                    for (size_t t = 0; t < threadCount; t++)
+                    {
+                        char threadArgument[16];
+                        snprintf(threadArgument, sizeof(threadArgument), "%ld", threads[t]);
+                        char *arguments[] = {mandelbrot, "-v", "-j", threadArgument, "-s", (char *)SUBDIVISIONS[m], "-x", (char *)scene->centerRe,
+                                             "-y", (char *)scene->centerIm, "-z", (char *)scene->zoom, widthArgument, heightArgument, OUTPUT_FILE,
+                                             limitArgument, NULL};
+
+                        double seconds[MAX_REPETITIONS];
+                        uint64_t iterations = 0, checksum = 0;
+                        for (int r = 0; r < repetitions; r++)
+                        {
+                            Run run = execute(arguments);
+                            if (run.status || !checksumImage(OUTPUT_FILE, &checksum))
+                            {
+                                fprintf(stderr, "mandelbrot failed on %s at %u x %u, %ld iterations, %ld threads, subdivision %s\n", scene->name,
+                                        width, height, limits[l], threads[t], SUBDIVISIONS[m]);
+                                free(sizes);
+                                free(mandelbrot);
+                                return 1;
+                            }
+                            seconds[r] = run.seconds;
+                            iterations = run.iterations;
+                            if (first)
+                                expected = checksum;
+                            first = false;
+                            if (checksum != expected)
+                            {
+                                fprintf(stderr, "Checksum of %s at %u x %u, %ld iterations, subdivision %s changed with %ld threads\n", scene->name,
+                                        width, height, limits[l], SUBDIVISIONS[m], threads[t]);
+                                consistent = false;
+                            }
+                        }
+
+                        BenchSummary summary;
+                        benchSummarize(seconds, repetitions, &summary);
+                        double median = summary.median;
+                        printf("%s,%s,%u,%u,%ld,%ld,%.6f,%.6f,%.4f,%.2f,%.3f,%016llx\n",
+                               scene->name,
+                               SUBDIVISIONS[m],
+                               width,
+                               height,
+                               limits[l],
+                               threads[t],
+                               median,
+                               summary.minimum,
+                               summary.deviation,
+                               (double)width * height / 1e6 / median,
+                               iterations / 1e9 / median,
+                               (unsigned long long)checksum);
+                        fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+
+    unlink(OUTPUT_FILE);
+    free(sizes);
+    free(mandelbrot);
+    return consistent ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+#include "mandelbrot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Reuse stops paying off once frames differ by more than this factor
+#define MAX_REUSE_ZOOM 2
+
+typedef struct Sequence
+{
+    const Animation *animation;
+    const Scene *scene;
+    RowKernel kernel;
+    ColorMap colorMap;
+    bool reuse;
+    // Runs of consecutive frames are the tasks, a frame can only reuse a predecessor of its own run
+    uint32_t runLength;
+    uint32_t runs;
+    atomic_uint_fast32_t nextRun;
+    atomic_uint_fast64_t computed;
+    atomic_bool failed;
+} Sequence;
+
+typedef struct Frame
+{
+    Scene scene;
+    uint16_t *iterations;
+} Frame;
+
+static void frameScene(const Sequence *sequence, uint32_t index, Scene *scene)
+{
+    const Animation *animation = sequence->animation;
+    double zoom = animation->startZoom;
+    if (animation->frames > 1)
+        zoom *= pow(animation->endZoom / animation->startZoom, (double)index / (animation->frames - 1));
+
+    *scene = *sequence->scene;
+    scene->spanRe = DEFAULT_SPAN_RE / zoom;
+    scene->spanIm = DEFAULT_SPAN_IM / zoom;
+    scene->minRe = animation->centerRe - scene->spanRe / 2;
+    scene->minIm = animation->centerIm - scene->spanIm / 2;
+}
+
+// Takes the count of the nearest pixel of the previous frame when its whole 3x3 neighbourhood has it.
+// Like subdivision, this assumes that nothing thinner than the neighbourhood crosses a uniform area
+static bool seedPixel(const Frame *previous, const Scene *scene, uint32_t x, uint32_t y, uint16_t *iterations)
+{
+    const Scene *before = &previous->scene;
+    // Offsets from the shared center keep their precision at any zoom
+    double re = (double)x * scene->spanRe / scene->width - scene->spanRe / 2;
+    double im = (double)y * scene->spanIm / scene->height - scene->spanIm / 2;
+    double column = floor((re + before->spanRe / 2) * before->width / before->spanRe + 0.5);
+    double row = floor((im + before->spanIm / 2) * before->height / before->spanIm + 0.5);
+    if (!(column >= 1 && row >= 1 && column <= before->width - 2.0 && row <= before->height - 2.0))
+        return false;
+
+    const uint16_t *center = previous->iterations + (size_t)row * before->width + (size_t)column;
+    for (int_fast8_t dy = -1; dy <= 1; dy++)
+    {
+        const uint16_t *neighbours = center + dy * (ptrdiff_t)before->width;
+        if (neighbours[-1] != *center || neighbours[0] != *center || neighbours[1] != *center)
+            return false;
+    }
+    *iterations = *center;
+    return true;
+}
+
+static bool renderFrame(Sequence *sequence, uint32_t index, Frame *frame, const Frame *previous, bool *known, BmpImage *image,
+                        uint_fast64_t *computed)
+{
+    const Scene *scene = &frame->scene;
+    for (uint32_t y = 0; y < scene->height; y++)
+    {
+        uint16_t *iterations = frame->iterations + (size_t)y * scene->width;
+        for (uint32_t x = 0; x < scene->width; x++)
+        {
+            known[x] = previous && seedPixel(previous, scene, x, y, iterations + x);
+        }
+
+        for (uint32_t x = 0; x < scene->width;)
+        {
+            if (known[x])
+            {
+                x++;
+                continue;
+            }
+            uint32_t end = x;
+            while (end < scene->width && !known[end])
+            {
+                end++;
+            }
+            sequence->kernel(scene, x, y, end - x, iterations + x, NULL);
+            *computed += end - x;
+            x = end;
+        }
+
+        uint8_t *row = bmpRow(image, y);
+        for (uint32_t x = 0; x < scene->width; x++)
+        {
+            row[x] = sequence->colorMap(iterations[x], scene->maxIterations);
+        }
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%05u.bmp", sequence->animation->directory, (unsigned)index);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool written = bmpWrite(fd, image);
+    return !close(fd) && written;
+}
+
+static void *sequenceWorker(void *arg)
+{
+    Sequence *sequence = arg;
+    const Scene *scene = sequence->scene;
+    size_t pixels = (size_t)scene->width * scene->height;
+    Frame frames[2] = {{.iterations = malloc(pixels * sizeof(uint16_t))}, {.iterations = malloc(pixels * sizeof(uint16_t))}};
+    bool *known = malloc(scene->width * sizeof(bool));
+    BmpImage image = {0};
+    bool allocated = frames[0].iterations && frames[1].iterations && known &&
+                     bmpAllocate(&image, scene->width, scene->height, BMP_GRAY8);
+
+    // Runs are left to the other threads when buffers cannot be allocated
+    uint_fast32_t run;
+    uint_fast64_t computed = 0;
+    while (allocated && !sequence->failed && (run = atomic_fetch_add(&sequence->nextRun, 1)) < sequence->runs)
+    {
+        uint32_t first = run * sequence->runLength;
+        uint32_t last = first + sequence->runLength < sequence->animation->frames ? first + sequence->runLength : sequence->animation->frames;
+        for (uint32_t index = first; index < last && !sequence->failed; index++)
+        {
+            Frame *frame = &frames[index % 2];
+            const Frame *previous = sequence->reuse && index > first ? &frames[(index + 1) % 2] : NULL;
+            frameScene(sequence, index, &frame->scene);
+            if (!renderFrame(sequence, index, frame, previous, known, &image, &computed))
+                sequence->failed = true;
+        }
+    }
+
+    atomic_fetch_add(&sequence->computed, computed);
+    free(frames[0].iterations);
+    free(frames[1].iterations);
+    free(known);
+    bmpRelease(&image);
+    return NULL;
+}
+
+bool renderAnimation(const Animation *animation, const Scene *scene, RowKernel kernel, const RenderOptions *options, uint_fast64_t *computed)
+{
+    if (mkdir(animation->directory, 0755) && errno != EEXIST)
+        return false;
+
+    Sequence sequence = {.animation = animation, .scene = scene, .kernel = kernel};
+    sequence.colorMap = options->colorMap ? options->colorMap : mapIterationsToColor;
+    double step = animation->frames > 1 ? pow(animation->endZoom / animation->startZoom, 1.0 / (animation->frames - 1)) : 1;
+    sequence.reuse = animation->reuse && step <= MAX_REUSE_ZOOM && step >= 1.0 / MAX_REUSE_ZOOM;
+
+    // A single thread reuses along the whole path, more threads get a few runs each to balance
+    // runs deep in the zoom, which cost more, against the cheap ones at the start
+    uint32_t runs = options->threads == 1 ? 1 : 2 * options->threads;
+    sequence.runLength = (animation->frames + runs - 1) / runs;
+    sequence.runs = (animation->frames + sequence.runLength - 1) / sequence.runLength;
+
+    pthread_t workers[MAX_THREADS];
+
+    // Calling thread renders as well, runs are shared by whatever threads managed to start
+    uint_fast16_t started = 0;
+    while (started < options->threads - 1 && started + 1 < sequence.runs && !pthread_create(&workers[started], NULL, sequenceWorker, &sequence))
+    {
+        started++;
+    }
+    sequenceWorker(&sequence);
+
+    for (uint_fast16_t i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    *computed = sequence.computed;
+    return !sequence.failed && sequence.nextRun >= sequence.runs;
+}
@@ -0,0 +1,143 @@
+#include "mandelbrot.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same counts at every optimization level, as with the Mandelbrot kernels
+#pragma GCC optimize("fp-contract=off")
+
+// Every formula gets its own loop: START picks c and the first z of a pixel at (pixelRe, pixelIm),
+// STEP advances re and im by one iteration with their squares re2 and im2 at hand.
+// Escape and cycle tests are the same as for the Mandelbrot set
+#define DEFINE_FORMULA(name, START, STEP)                                                                                            \
+    static uint_fast16_t iterate##name(const Scene *scene, double cRe, double cIm, double re, double im, uint_fast64_t *work)        \
+    {                                                                                                                                \
+        double re2 = re * re, im2 = im * im;                                                                                         \
+        double savedRe = re, savedIm = im;                                                                                           \
+        uint_fast32_t interval = 1, steps = 0;                                                                                       \
+        for (uint_fast16_t i = 0; i < scene->maxIterations; i++)                                                                     \
+        {                                                                                                                            \
+            STEP;                                                                                                                    \
+            re2 = re * re;                                                                                                           \
+            im2 = im * im;                                                                                                           \
+            if (re2 + im2 > 4)                                                                                                       \
+            {                                                                                                                        \
+                *work += i + 1;                                                                                                      \
+                return i;                                                                                                            \
+            }                                                                                                                        \
+            if (scene->shortcuts)                                                                                                    \
+            {                                                                                                                        \
+                if (re == savedRe && im == savedIm)                                                                                  \
+                {                                                                                                                    \
+                    *work += i + 1;                                                                                                  \
+                    return scene->maxIterations;                                                                                     \
+                }                                                                                                                    \
+                if (++steps == interval)                                                                                             \
+                {                                                                                                                    \
+                    savedRe = re;                                                                                                    \
+                    savedIm = im;                                                                                                    \
+                    steps = 0;                                                                                                       \
+                    interval *= 2;                                                                                                   \
+                }                                                                                                                    \
+            }                                                                                                                        \
+        }                                                                                                                            \
+        *work += scene->maxIterations;                                                                                               \
+        return scene->maxIterations;                                                                                                 \
+    }                                                                                                                                \
+                                                                                                                                     \
+    static uint_fast64_t row##name(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations, double *finalZ) \
+    {                                                                                                                                \
+        /* Only the Mandelbrot set keeps a state to continue from */                                                                 \
+        (void)finalZ;                                                                                                                \
+        double pixelIm = mapY(scene, y);                                                                                             \
+        uint_fast64_t work = 0;                                                                                                      \
+        for (uint32_t i = 0; i < count; i++)                                                                                         \
+        {                                                                                                                            \
+            double pixelRe = mapX(scene, x + i);                                                                                     \
+            double cRe, cIm, re, im;                                                                                                 \
+            START;                                                                                                                   \
+            iterations[i] = iterate##name(scene, cRe, cIm, re, im, &work);                                                           \
+        }                                                                                                                            \
+        return work;                                                                                                                 \
+    }
+
+#define MANDELBROT_START (cRe = pixelRe, cIm = pixelIm, re = 0, im = 0)
+#define JULIA_START (cRe = scene->juliaRe, cIm = scene->juliaIm, re = pixelRe, im = pixelIm)
+
+#define QUADRATIC_STEP                \
+    do                                \
+    {                                 \
+        im = 2 * re * im + cIm;       \
+        re = re2 - im2 + cRe;         \
+    } while (0)
+
+// Burning Ship folds z into the first quadrant before squaring, which only changes the sign of 2 re im
+#define BURNING_SHIP_STEP             \
+    do                                \
+    {                                 \
+        im = fabs(2 * re * im) + cIm; \
+        re = re2 - im2 + cRe;         \
+    } while (0)
+
+// z^d by d - 1 complex multiplications, fully unrolled for the constant degree
+#define MULTIBROT_STEP(degree)                                    \
+    do                                                            \
+    {                                                             \
+        double powerRe = re, powerIm = im;                        \
+        _Pragma("GCC unroll 8") for (int k = 1; k < degree; k++) \
+        {                                                         \
+            double product = powerRe * re - powerIm * im;         \
+            powerIm = powerRe * im + powerIm * re;                \
+            powerRe = product;                                    \
+        }                                                         \
+        re = powerRe + cRe;                                       \
+        im = powerIm + cIm;                                       \
+    } while (0)
+
+DEFINE_FORMULA(Julia, JULIA_START, QUADRATIC_STEP)
+DEFINE_FORMULA(BurningShip, MANDELBROT_START, BURNING_SHIP_STEP)
+DEFINE_FORMULA(Multibrot3, MANDELBROT_START, MULTIBROT_STEP(3))
+DEFINE_FORMULA(Multibrot4, MANDELBROT_START, MULTIBROT_STEP(4))
+DEFINE_FORMULA(Multibrot5, MANDELBROT_START, MULTIBROT_STEP(5))
+DEFINE_FORMULA(Multibrot6, MANDELBROT_START, MULTIBROT_STEP(6))
+DEFINE_FORMULA(Multibrot7, MANDELBROT_START, MULTIBROT_STEP(7))
+DEFINE_FORMULA(Multibrot8, MANDELBROT_START, MULTIBROT_STEP(8))
+
+static const RowKernel multibrotKernels[MAX_DEGREE - MIN_DEGREE + 1] = {
+    rowMultibrot3, rowMultibrot4, rowMultibrot5, rowMultibrot6, rowMultibrot7, rowMultibrot8,
+};
+
+bool parseFormula(const char *text, Formula *formula)
+{
+    *formula = (Formula){.centerRe = DEFAULT_CENTER_RE, .centerIm = DEFAULT_CENTER_IM};
+    char *end;
+    if (!strcmp(text, "mandelbrot"))
+        return true;
+    if (!strcmp(text, "burning-ship"))
+    {
+        // Most of the ship lies below the real axis
+        *formula = (Formula){.kernel = rowBurningShip, .centerRe = -0.5, .centerIm = -0.5};
+        return true;
+    }
+    if (!strncmp(text, "multibrot:", strlen("multibrot:")))
+    {
+        long degree = strtol(text + strlen("multibrot:"), &end, 10);
+        if (*end || degree < MIN_DEGREE || degree > MAX_DEGREE)
+            return false;
+        *formula = (Formula){.kernel = multibrotKernels[degree - MIN_DEGREE]};
+        return true;
+    }
+    if (!strncmp(text, "julia:", strlen("julia:")))
+    {
+        const char *start = text + strlen("julia:");
+        *formula = (Formula){.kernel = rowJulia};
+        formula->juliaRe = strtod(start, &end);
+        if (end == start || *end != ',')
+            return false;
+        start = end + 1;
+        formula->juliaIm = strtod(start, &end);
+        return end != start && !*end;
+    }
+    return false;
+}
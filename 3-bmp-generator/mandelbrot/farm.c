@@ -0,0 +1,204 @@
+#include "mandelbrot.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Ranges per worker, enough to balance expensive rows through the set against cheap ones
+#define RANGES_PER_WORKER 16
+
+// Sent to a worker to assign rows, and back once they are in the file. No rows ends the worker
+typedef struct RowRange
+{
+    uint32_t first;
+    uint32_t count;
+    uint64_t computed;
+} RowRange;
+
+typedef struct Worker
+{
+    pid_t pid;
+    int socket;
+    bool busy;
+    RowRange range;
+} Worker;
+
+// Worker process: renders every range it gets into a buffer and writes it at its offset in the file
+static void runWorker(int socket, const char *path, const Scene *scene, RowKernel kernel, const RenderOptions *options)
+{
+    int output = open(path, O_WRONLY);
+    BmpHeaders headers;
+    BmpImage image = {.width = scene->width, .height = scene->height, .format = BMP_GRAY8};
+    bmpInitHeaders(&headers, &image);
+
+    RowRange range;
+    while (output >= 0 && bmpTransfer(socket, &range, sizeof(range), 0, false) && range.count)
+    {
+        if (!bmpAllocate(&image, scene->width, range.count, BMP_GRAY8))
+            break;
+        RenderOptions rows = *options;
+        rows.firstRow = range.first;
+        rows.rowCount = range.count;
+        uint_fast64_t computed = 0;
+        bool written = renderImage(&image, scene, kernel, &rows, &computed) &&
+                       bmpWritePixels(output, headers.file.bfOffBits + (off_t)range.first * image.stride, &image);
+        bmpRelease(&image);
+        range.computed = computed;
+        // Failing workers just quit, the coordinator treats them as dead
+        if (!written || !bmpTransfer(socket, &range, sizeof(range), 0, true))
+            break;
+    }
+    if (output >= 0)
+        close(output);
+    close(socket);
+}
+
+// Ranges of dead workers are pushed back on top of the queue
+static void stopWorker(Worker *worker, RowRange *queue, uint32_t *queued)
+{
+    if (worker->busy)
+        queue[(*queued)++] = worker->range;
+    close(worker->socket);
+    waitpid(worker->pid, NULL, 0);
+    worker->pid = 0;
+    worker->busy = false;
+}
+
+static bool assignRange(Worker *worker, RowRange *queue, uint32_t *queued)
+{
+    worker->range = queue[--*queued];
+    worker->busy = true;
+    return send(worker->socket, &worker->range, sizeof(RowRange), MSG_NOSIGNAL) == sizeof(RowRange);
+}
+
+const char *renderFarm(const char *path, const Scene *scene, RowKernel kernel, const RenderOptions *options, uint_fast16_t workers,
+                       uint_fast64_t *computed)
+{
+    BmpImage image = {.width = scene->width, .height = scene->height, .format = BMP_GRAY8};
+    image.stride = bmpRowLength(image.width, BMP_GRAY8);
+    if (bmpHeadersLength(image.format) + bmpDataLength(&image) > UINT32_MAX)
+        return "Image does not fit into 32-bit bitmap size fields, tiled output has no such limit";
+
+    // File gets its final size up front, workers write their rows anywhere in it
+    int output = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (output < 0)
+        return "Failed to access the output file";
+    BmpHeaders headers;
+    bmpInitHeaders(&headers, &image);
+    bool sized = bmpWriteHeaders(output, &headers, image.format) && !ftruncate(output, headers.file.bfSize);
+    close(output);
+    if (!sized)
+        return "Failed to size the output file, it has to be a regular file";
+
+    // Ranges stay aligned to subdivision tiles, so every tile is split the same way as in a single render
+    uint32_t alignment = options->minimumTile ? SUBDIVISION_TILE : 1;
+    uint32_t rangeRows = (scene->height + workers * RANGES_PER_WORKER - 1) / (workers * RANGES_PER_WORKER);
+    rangeRows = (rangeRows + alignment - 1) / alignment * alignment;
+    uint32_t ranges = (scene->height + rangeRows - 1) / rangeRows;
+    RowRange *queue = malloc(ranges * sizeof(RowRange));
+    Worker *pool = calloc(workers, sizeof(Worker));
+    struct pollfd *polls = malloc(workers * sizeof(struct pollfd));
+    if (!queue || !pool || !polls)
+    {
+        free(queue);
+        free(pool);
+        free(polls);
+        return "Failed to allocate memory for the workers";
+    }
+    // Queue is taken from the end, so the first rows go out first
+    uint32_t queued = 0;
+    for (uint32_t i = ranges; i-- > 0;)
+    {
+        uint32_t first = i * rangeRows;
+        queue[queued++] = (RowRange){.first = first, .count = scene->height - first < rangeRows ? scene->height - first : rangeRows};
+    }
+
+    uint_fast16_t alive = 0;
+    for (uint_fast16_t i = 0; i < workers; i++)
+    {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets))
+            break;
+        pid_t pid = fork();
+        if (!pid)
+        {
+            close(sockets[0]);
+            for (uint_fast16_t j = 0; j < alive; j++)
+            {
+                close(pool[j].socket);
+            }
+            runWorker(sockets[1], path, scene, kernel, options);
+            _exit(0);
+        }
+        close(sockets[1]);
+        if (pid < 0)
+        {
+            close(sockets[0]);
+            break;
+        }
+        pool[alive++] = (Worker){.pid = pid, .socket = sockets[0]};
+    }
+
+    uint32_t done = 0;
+    *computed = 0;
+    for (uint_fast16_t i = 0; i < alive; i++)
+    {
+        if (queued && !assignRange(&pool[i], queue, &queued))
+            stopWorker(&pool[i], queue, &queued);
+    }
+
+    while (done < ranges)
+    {
+        nfds_t count = 0;
+        for (uint_fast16_t i = 0; i < alive; i++)
+        {
+            if (pool[i].busy)
+                polls[count++] = (struct pollfd){.fd = pool[i].socket, .events = POLLIN};
+        }
+        // Every worker died with rows left
+        if (!count)
+            break;
+        if (poll(polls, count, -1) < 0)
+            continue;
+
+        for (uint_fast16_t i = 0, slot = 0; i < alive; i++)
+        {
+            Worker *worker = &pool[i];
+            if (!worker->busy || !polls[slot++].revents)
+                continue;
+
+            RowRange range;
+            if (!bmpTransfer(worker->socket, &range, sizeof(range), 0, false) || range.first != worker->range.first)
+            {
+                stopWorker(worker, queue, &queued);
+                continue;
+            }
+            worker->busy = false;
+            *computed += range.computed;
+            done++;
+        }
+
+        // Idle workers take the next rows, including the ones left by dead workers
+        for (uint_fast16_t i = 0; i < alive && queued; i++)
+        {
+            if (pool[i].pid && !pool[i].busy && !assignRange(&pool[i], queue, &queued))
+                stopWorker(&pool[i], queue, &queued);
+        }
+    }
+
+    RowRange finished = {0};
+    for (uint_fast16_t i = 0; i < alive; i++)
+    {
+        if (!pool[i].pid)
+            continue;
+        send(pool[i].socket, &finished, sizeof(finished), MSG_NOSIGNAL);
+        stopWorker(&pool[i], queue, &queued);
+    }
+    free(queue);
+    free(pool);
+    free(polls);
+    return done == ranges ? NULL : "Every worker failed before the image was complete";
+}
@@ -0,0 +1,360 @@
+#include "mandelbrot.h"
+
+#include <immintrin.h>
+#include <math.h>
+#include <string.h>
+
+// Vector kernels must produce exactly the same counts as the scalar one,
+// so multiplications and additions are never fused into FMA instructions
+#pragma GCC optimize("fp-contract=off")
+
+// Main cardioid and period-2 bulb, the points just outside of their boundaries
+// need far more than 65535 iterations to escape
+static inline bool isInsideBulbs(double cRe, double cIm)
+{
+    double shifted = cRe - 0.25;
+    double q = shifted * shifted + cIm * cIm;
+    return q * (q + shifted) < 0.25 * cIm * cIm || (cRe + 1) * (cRe + 1) + cIm * cIm < 0.0625;
+}
+
+// Escape is tested on squared magnitude, which needs no square root.
+// With shortcuts, z is compared with a value saved at growing power-of-two intervals (Brent):
+// an exact repeat means the orbit cycles and would never escape.
+// Iteration starts from z at the given count, z is left at its final value or NaN for a cycle.
+// Iterations actually performed are added to work
+static uint_fast16_t iterate(const Scene *scene, double cRe, double cIm, uint_fast16_t start, double *z, uint_fast64_t *work)
+{
+    double re = z[0], im = z[1], re2 = re * re, im2 = im * im;
+    double savedRe = re, savedIm = im;
+    uint_fast32_t interval = 1, steps = 0;
+    for (uint_fast16_t i = start; i < scene->maxIterations; i++)
+    {
+        im = 2 * re * im + cIm;
+        re = re2 - im2 + cRe;
+        re2 = re * re;
+        im2 = im * im;
+        if (re2 + im2 > 4)
+        {
+            *work += i - start + 1;
+            return i;
+        }
+        if (scene->shortcuts)
+        {
+            if (re == savedRe && im == savedIm)
+            {
+                *work += i - start + 1;
+                z[0] = z[1] = NAN;
+                return scene->maxIterations;
+            }
+            if (++steps == interval)
+            {
+                savedRe = re;
+                savedIm = im;
+                steps = 0;
+                interval *= 2;
+            }
+        }
+    }
+    *work += scene->maxIterations - start;
+    z[0] = re;
+    z[1] = im;
+    return scene->maxIterations;
+}
+
+uint_fast16_t getIterations(const Scene *scene, uint32_t x, uint32_t y, double *finalZ, uint_fast64_t *work)
+{
+    double cRe = mapX(scene, x);
+    double cIm = mapY(scene, y);
+    double z[2] = {NAN, NAN};
+    uint_fast16_t iterations = scene->maxIterations;
+    if (!scene->shortcuts || !isInsideBulbs(cRe, cIm))
+    {
+        z[0] = z[1] = 0;
+        iterations = iterate(scene, cRe, cIm, 0, z, work);
+    }
+    if (finalZ)
+    {
+        finalZ[0] = z[0];
+        finalZ[1] = z[1];
+    }
+    return iterations;
+}
+
+uint_fast16_t resumeIterations(const Scene *scene, uint32_t x, uint32_t y, uint_fast16_t start, double *z, uint_fast64_t *work)
+{
+    if (isnan(z[0]))
+        return scene->maxIterations;
+    return iterate(scene, mapX(scene, x), mapY(scene, y), start, z, work);
+}
+
+static uint_fast64_t rowScalar(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations, double *finalZ)
+{
+    uint_fast64_t work = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        iterations[i] = getIterations(scene, x + i, y, finalZ ? finalZ + 2 * i : NULL, &work);
+    }
+    return work;
+}
+
+static uint_fast64_t columnScalar(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations)
+{
+    uint_fast64_t work = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        iterations[i] = getIterations(scene, x, y + i, NULL, &work);
+    }
+    return work;
+}
+
+// Lanes that escaped stop counting, the group runs until every lane has escaped or hit the maximum.
+// Only the first count lanes take part, so that short spans do not fall back to scalar code.
+// Counts go to iterations[0, count), final z to finalZ unless it is NULL
+__attribute__((target("avx2"))) static inline uint_fast64_t groupAvx2(const Scene *scene, __m256d cRe, __m256d cIm, uint_fast8_t count,
+                                                                      uint16_t *iterations, double *finalZ)
+{
+    const __m256d two = _mm256_set1_pd(2);
+    const __m256d four = _mm256_set1_pd(4);
+    const __m256d one = _mm256_set1_pd(1);
+
+    __m256d re = _mm256_setzero_pd(), im = re, re2 = re, im2 = re, counts = re, savedRe = re, savedIm = re;
+    __m256d active = _mm256_cmp_pd(_mm256_set_pd(3, 2, 1, 0), _mm256_set1_pd(count), _CMP_LT_OQ);
+    // Lanes known to never escape are reported as maxIterations
+    __m256d bounded = _mm256_setzero_pd();
+    uint_fast32_t interval = 1, steps = 0;
+
+    if (scene->shortcuts)
+    {
+        double real[4], imaginary[4];
+        _mm256_storeu_pd(real, cRe);
+        _mm256_storeu_pd(imaginary, cIm);
+        bounded = _mm256_castsi256_pd(_mm256_set_epi64x(-(int64_t)isInsideBulbs(real[3], imaginary[3]),
+                                                        -(int64_t)isInsideBulbs(real[2], imaginary[2]),
+                                                        -(int64_t)isInsideBulbs(real[1], imaginary[1]),
+                                                        -(int64_t)isInsideBulbs(real[0], imaginary[0])));
+        active = _mm256_andnot_pd(bounded, active);
+    }
+    // Lanes skipped by the bulb test did no work
+    double inside[4];
+    _mm256_storeu_pd(inside, bounded);
+
+    for (uint_fast16_t n = 0; n < scene->maxIterations && !_mm256_testz_pd(active, active); n++)
+    {
+        im = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, re), im), cIm);
+        re = _mm256_add_pd(_mm256_sub_pd(re2, im2), cRe);
+        re2 = _mm256_mul_pd(re, re);
+        im2 = _mm256_mul_pd(im, im);
+        __m256d escaped = _mm256_cmp_pd(_mm256_add_pd(re2, im2), four, _CMP_GT_OQ);
+        active = _mm256_andnot_pd(escaped, active);
+        if (scene->shortcuts)
+        {
+            __m256d cycled = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(re, savedRe, _CMP_EQ_OQ),
+                                                         _mm256_cmp_pd(im, savedIm, _CMP_EQ_OQ)),
+                                           active);
+            bounded = _mm256_or_pd(bounded, cycled);
+            active = _mm256_andnot_pd(cycled, active);
+            if (++steps == interval)
+            {
+                savedRe = re;
+                savedIm = im;
+                steps = 0;
+                interval *= 2;
+            }
+        }
+        counts = _mm256_add_pd(counts, _mm256_and_pd(active, one));
+    }
+
+    double lanes[4], stopped[4], finalRe[4], finalIm[4];
+    _mm256_storeu_pd(lanes, counts);
+    _mm256_storeu_pd(stopped, bounded);
+    _mm256_storeu_pd(finalRe, re);
+    _mm256_storeu_pd(finalIm, im);
+    uint_fast64_t work = 0;
+    for (uint_fast8_t lane = 0; lane < count; lane++)
+    {
+        iterations[lane] = stopped[lane] != 0 ? scene->maxIterations : lanes[lane];
+        // A lane that stopped early also performed the step it stopped on
+        if (inside[lane] == 0)
+            work += lanes[lane] < scene->maxIterations ? lanes[lane] + 1 : scene->maxIterations;
+        if (finalZ)
+        {
+            finalZ[2 * lane] = stopped[lane] != 0 ? NAN : finalRe[lane];
+            finalZ[2 * lane + 1] = stopped[lane] != 0 ? NAN : finalIm[lane];
+        }
+    }
+    return work;
+}
+
+// Lanes take c the same way as mapX and mapY, so that counts match the scalar kernel
+__attribute__((target("avx2"))) static uint_fast64_t rowAvx2(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations, double *finalZ)
+{
+    const __m256d span = _mm256_set1_pd(scene->spanRe);
+    const __m256d minimum = _mm256_set1_pd(scene->minRe);
+    const __m256d width = _mm256_set1_pd(scene->width);
+    const __m256d cIm = _mm256_set1_pd(mapY(scene, y));
+
+    uint_fast64_t work = 0;
+    for (uint32_t i = 0; i < count; i += 4)
+    {
+        __m256d column = _mm256_set_pd(x + i + 3, x + i + 2, x + i + 1, x + i);
+        __m256d cRe = _mm256_add_pd(_mm256_div_pd(_mm256_mul_pd(column, span), width), minimum);
+        work += groupAvx2(scene, cRe, cIm, count - i < 4 ? count - i : 4, iterations + i, finalZ ? finalZ + 2 * i : NULL);
+    }
+    return work;
+}
+
+__attribute__((target("avx2"))) static uint_fast64_t columnAvx2(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations)
+{
+    const __m256d span = _mm256_set1_pd(scene->spanIm);
+    const __m256d minimum = _mm256_set1_pd(scene->minIm);
+    const __m256d height = _mm256_set1_pd(scene->height);
+    const __m256d cRe = _mm256_set1_pd(mapX(scene, x));
+
+    uint_fast64_t work = 0;
+    for (uint32_t i = 0; i < count; i += 4)
+    {
+        __m256d row = _mm256_set_pd(y + i + 3, y + i + 2, y + i + 1, y + i);
+        __m256d cIm = _mm256_add_pd(_mm256_div_pd(_mm256_mul_pd(row, span), height), minimum);
+        work += groupAvx2(scene, cRe, cIm, count - i < 4 ? count - i : 4, iterations + i, NULL);
+    }
+    return work;
+}
+
+__attribute__((target("avx512f"))) static inline uint_fast64_t groupAvx512(const Scene *scene, __m512d cRe, __m512d cIm, uint_fast8_t count,
+                                                                           uint16_t *iterations, double *finalZ)
+{
+    const __m512d two = _mm512_set1_pd(2);
+    const __m512d four = _mm512_set1_pd(4);
+    const __m512d one = _mm512_set1_pd(1);
+
+    __m512d re = _mm512_setzero_pd(), im = re, re2 = re, im2 = re, counts = re, savedRe = re, savedIm = re;
+    __mmask8 active = 0xFF >> (8 - count);
+    // Lanes known to never escape are reported as maxIterations
+    __mmask8 bounded = 0;
+    uint_fast32_t interval = 1, steps = 0;
+
+    if (scene->shortcuts)
+    {
+        double real[8], imaginary[8];
+        _mm512_storeu_pd(real, cRe);
+        _mm512_storeu_pd(imaginary, cIm);
+        for (uint_fast8_t lane = 0; lane < 8; lane++)
+        {
+            bounded |= isInsideBulbs(real[lane], imaginary[lane]) << lane;
+        }
+        active &= ~bounded;
+    }
+    // Lanes skipped by the bulb test did no work
+    __mmask8 inside = bounded;
+
+    for (uint_fast16_t n = 0; n < scene->maxIterations && active; n++)
+    {
+        im = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two, re), im), cIm);
+        re = _mm512_add_pd(_mm512_sub_pd(re2, im2), cRe);
+        re2 = _mm512_mul_pd(re, re);
+        im2 = _mm512_mul_pd(im, im);
+        active &= ~_mm512_cmp_pd_mask(_mm512_add_pd(re2, im2), four, _CMP_GT_OQ);
+        if (scene->shortcuts)
+        {
+            __mmask8 cycled = _mm512_mask_cmp_pd_mask(active, re, savedRe, _CMP_EQ_OQ) &
+                              _mm512_cmp_pd_mask(im, savedIm, _CMP_EQ_OQ);
+            bounded |= cycled;
+            active &= ~cycled;
+            if (++steps == interval)
+            {
+                savedRe = re;
+                savedIm = im;
+                steps = 0;
+                interval *= 2;
+            }
+        }
+        counts = _mm512_mask_add_pd(counts, active, counts, one);
+    }
+
+    double lanes[8];
+    _mm512_storeu_pd(lanes, counts);
+    uint_fast64_t work = 0;
+    for (uint_fast8_t lane = 0; lane < count; lane++)
+    {
+        // A lane that stopped early also performed the step it stopped on
+        if (!(inside >> lane & 1))
+            work += lanes[lane] < scene->maxIterations ? lanes[lane] + 1 : scene->maxIterations;
+        iterations[lane] = bounded >> lane & 1 ? scene->maxIterations : lanes[lane];
+    }
+    if (finalZ)
+    {
+        double finalRe[8], finalIm[8];
+        _mm512_storeu_pd(finalRe, _mm512_mask_mov_pd(re, bounded, _mm512_set1_pd(NAN)));
+        _mm512_storeu_pd(finalIm, _mm512_mask_mov_pd(im, bounded, _mm512_set1_pd(NAN)));
+        for (uint_fast8_t lane = 0; lane < count; lane++)
+        {
+            finalZ[2 * lane] = finalRe[lane];
+            finalZ[2 * lane + 1] = finalIm[lane];
+        }
+    }
+    return work;
+}
+
+__attribute__((target("avx512f"))) static uint_fast64_t rowAvx512(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations, double *finalZ)
+{
+    const __m512d span = _mm512_set1_pd(scene->spanRe);
+    const __m512d minimum = _mm512_set1_pd(scene->minRe);
+    const __m512d width = _mm512_set1_pd(scene->width);
+    const __m512d cIm = _mm512_set1_pd(mapY(scene, y));
+    const __m512d offsets = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+
+    uint_fast64_t work = 0;
+    for (uint32_t i = 0; i < count; i += 8)
+    {
+        __m512d column = _mm512_add_pd(_mm512_set1_pd(x + i), offsets);
+        __m512d cRe = _mm512_add_pd(_mm512_div_pd(_mm512_mul_pd(column, span), width), minimum);
+        work += groupAvx512(scene, cRe, cIm, count - i < 8 ? count - i : 8, iterations + i, finalZ ? finalZ + 2 * i : NULL);
+    }
+    return work;
+}
+
+__attribute__((target("avx512f"))) static uint_fast64_t columnAvx512(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations)
+{
+    const __m512d span = _mm512_set1_pd(scene->spanIm);
+    const __m512d minimum = _mm512_set1_pd(scene->minIm);
+    const __m512d height = _mm512_set1_pd(scene->height);
+    const __m512d cRe = _mm512_set1_pd(mapX(scene, x));
+    const __m512d offsets = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+
+    uint_fast64_t work = 0;
+    for (uint32_t i = 0; i < count; i += 8)
+    {
+        __m512d row = _mm512_add_pd(_mm512_set1_pd(y + i), offsets);
+        __m512d cIm = _mm512_add_pd(_mm512_div_pd(_mm512_mul_pd(row, span), height), minimum);
+        work += groupAvx512(scene, cRe, cIm, count - i < 8 ? count - i : 8, iterations + i, NULL);
+    }
+    return work;
+}
+
+RowKernel selectKernel(const char *name)
+{
+    __builtin_cpu_init();
+    bool avx512 = __builtin_cpu_supports("avx512f");
+    bool avx2 = __builtin_cpu_supports("avx2");
+
+    if (!name)
+        return avx512 ? rowAvx512 : avx2 ? rowAvx2 : rowScalar;
+    if (!strcmp(name, "scalar"))
+        return rowScalar;
+    if (!strcmp(name, "avx2") && avx2)
+        return rowAvx2;
+    if (!strcmp(name, "avx512") && avx512)
+        return rowAvx512;
+    return NULL;
+}
+
+ColumnKernel selectColumnKernel(RowKernel kernel)
+{
+    if (kernel == rowAvx512)
+        return columnAvx512;
+    if (kernel == rowAvx2)
+        return columnAvx2;
+    if (kernel == rowScalar)
+        return columnScalar;
+    return NULL;
+}
@@ -1,136 +1,308 @@
-#include <complex.h>
-#include <limits.h>
-#include <math.h>
+#include "mandelbrot.h"
+
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-#define FILE_TYPE 0x4D42
-#define FILE_HEADER 14
-#define DIB_HEADER 108
-#define HEADER (FILE_HEADER + DIB_HEADER)
-#define PLANE_NUMBER 1
-#define BITS_PER_PIXEL 8
-#define PALETTE_COLORS (1 << BITS_PER_PIXEL)
-#define PALETTE_BYTES 4
-#define PIXELS_PER_METRE 11812
-
-const uint_fast8_t ZERO = 0;
-
-void write32to16(uint16_t *target, uint_fast32_t value)
+// Returns an error message or NULL
+static const char *renderFile(const char *path, const Scene *scene, RowKernel kernel, const RenderOptions *options, uint_fast64_t *computed)
 {
-    target[0] = value;
-    target[1] = (value >> 16);
-}
+    BmpImage image = {.width = scene->width, .height = scene->height, .format = BMP_GRAY8};
+    image.stride = bmpRowLength(image.width, BMP_GRAY8);
+    if (bmpHeadersLength(image.format) + bmpDataLength(&image) > UINT32_MAX)
+        return "Image does not fit into 32-bit bitmap size fields, tiled output has no such limit";
 
-void writeGrayscalePalette(FILE *target)
-{
-    for (uint_fast32_t value = 0; value < PALETTE_COLORS; value++)
+    // Read access is needed to map the output
+    int output = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (output < 0)
+        return "Failed to access the output file";
+
+    // Pixels are rendered straight into the file sized from the header,
+    // outputs that cannot be mapped get a framebuffer written at the end
+    BmpHeaders headers;
+    bmpInitHeaders(&headers, &image);
+    bool written = bmpWriteHeaders(output, &headers, image.format);
+    bool mapped = written && bmpMap(&image, output, headers.file.bfOffBits, true);
+    if (!mapped && !bmpAllocate(&image, image.width, image.height, BMP_GRAY8))
     {
-        for (uint_fast8_t i = 0; i < PALETTE_BYTES - 1; i++)
-        {
-            fwrite(&value, 1, 1, target);
-            if (i == PALETTE_BYTES - 2)
-            {
-                fwrite(&ZERO, 1, 1, target);
-            }
-        }
+        close(output);
+        return "Failed to allocate memory for the image";
     }
-}
 
-void writeHeaders(uint_fast32_t width, uint_fast32_t height, uint_fast32_t rowLength, FILE *target)
-{
-    uint16_t header[HEADER / 2] = {FILE_TYPE};
-
-    uint_fast32_t palette = PALETTE_COLORS * PALETTE_BYTES;
-    uint_fast32_t data = rowLength * height;
-    uint_fast32_t offset = HEADER + palette;
-    uint_fast32_t file = offset + data;
-
-    write32to16(&header[1], file);
-    write32to16(&header[5], offset);
-    write32to16(&header[7], DIB_HEADER);
-    write32to16(&header[9], width);
-    write32to16(&header[11], height);
-    header[13] = PLANE_NUMBER;
-    header[14] = BITS_PER_PIXEL;
-    write32to16(&header[17], data);
-    write32to16(&header[19], PIXELS_PER_METRE);
-    write32to16(&header[21], PIXELS_PER_METRE);
-    write32to16(&header[23], PALETTE_COLORS);
-
-    fwrite(header, HEADER, 1, target);
-
-    writeGrayscalePalette(target);
-}
+    bool rendered = renderImage(&image, scene, kernel, options, computed);
 
-uint_fast16_t getIterations(uint_fast32_t width, uint_fast32_t height, uint_fast32_t x, uint_fast32_t y, uint_fast16_t maxIterations)
-{
-    double mappedX = (double)x * 3 / width - 2;
-    double mappedY = (double)y * 2 / height - 1;
-    double complex c = mappedX + mappedY * I;
-    double complex z = 0;
-    for (uint_fast16_t i = 0; i < maxIterations; i++)
-    {
-        z = z * z + c;
-        if (cabs(z) > 2)
-        {
-            return i;
-        }
+    if (mapped)
+        bmpUnmap(&image, headers.file.bfOffBits);
+    else
+    {
+        written = written && bmpWritePixels(output, headers.file.bfOffBits, &image);
+        bmpRelease(&image);
     }
-    return maxIterations;
+    close(output);
+    if (!rendered)
+        return "Failed to allocate memory for the render buffers, state or statistics";
+    return written ? NULL : "Failed to write the output file";
 }
 
-uint_fast8_t mapIterationsToColor(uint_fast16_t n, uint_fast16_t max)
+int main(int argc, char *argv[])
 {
-    return (float)n / max * 255;
-}
+    long threads = 0;
+    long workers = 0;
+    char *kernelName = NULL;
+    bool shortcuts = true;
+    bool reuse = false;
+    long minimumTile = 0;
+    const char *centerRe = NULL, *centerIm = NULL;
+    double zoom = 1;
+    bool perturbation = false;
+    long tileSize = 0, levels = 0;
+    const char *statePath = NULL, *colorMapName = NULL;
+    long frames = 0;
+    double endZoom = 0;
+    const char *formulaName = "mandelbrot";
+    bool verbose = false;
+    const char *heatmapPath = NULL;
 
-void writePixels(uint_fast32_t width, uint_fast32_t height, uint_fast32_t rowLength, FILE *target, uint_fast16_t maxIterations)
-{
-    for (uint_fast32_t y = 0; y < height; y++)
+    int option;
+    while ((option = getopt(argc, argv, "j:k:Ss:x:y:z:pt:P:c:m:a:Z:rf:w:vH:")) != -1)
     {
-        for (uint_fast32_t x = 0; x < width; x++)
-        {
-            uint_fast16_t iterations = getIterations(width, height, x, y, maxIterations);
-            uint_fast8_t color = mapIterationsToColor(iterations, maxIterations);
-            fwrite(&color, 1, 1, target);
-        }
-        for (uint_fast8_t p = 0; p < rowLength - width; p++)
-        {
-            fwrite(&ZERO, 1, 1, target);
-        }
+        if (option == 'j')
+            threads = atol(optarg);
+        else if (option == 'k')
+            kernelName = optarg;
+        else if (option == 'S')
+            shortcuts = false;
+        else if (option == 's')
+            minimumTile = atol(optarg);
+        else if (option == 'x')
+            centerRe = optarg;
+        else if (option == 'y')
+            centerIm = optarg;
+        else if (option == 'z')
+            zoom = atof(optarg);
+        else if (option == 'p')
+            perturbation = true;
+        else if (option == 't')
+            tileSize = atol(optarg);
+        else if (option == 'P')
+            levels = atol(optarg);
+        else if (option == 'c')
+            statePath = optarg;
+        else if (option == 'm')
+            colorMapName = optarg;
+        else if (option == 'a')
+            frames = atol(optarg);
+        else if (option == 'Z')
+            endZoom = atof(optarg);
+        else if (option == 'r')
+            reuse = true;
+        else if (option == 'f')
+            formulaName = optarg;
+        else if (option == 'w')
+            workers = atol(optarg);
+        else if (option == 'v')
+            verbose = true;
+        else if (option == 'H')
+            heatmapPath = optarg;
+        else
+            argc = 0;
     }
-}
+    argv += optind - 1;
 
-int main(int argc, char *argv[])
-{
-    if (argc != 5)
+    if (argc - optind != 4)
     {
-        fprintf(stderr, "The program accepts exactly three positional arguments: image width, height, output path, and max number of iterations");
+        fprintf(stderr, "The program accepts exactly four positional arguments: image width, height, output path, and max number of iterations\n"
+                        "Optional flags:\n"
+                        "-j <threads> (number of rendering threads, all cores by default, one per worker process)\n"
+                        "-w <workers> (render with worker processes that write ranges of rows into the output file)\n"
+                        "-k {scalar|avx2|avx512} (escape-time kernel, the widest supported one by default)\n"
+                        "-S (iterate every point instead of skipping the ones known to be inside the set)\n"
+                        "-s <size> (only evaluate borders of rectangles and fill uniform ones, splitting down to size,\n"
+                        "          with the interior shortcuts sizes below 16 only pay off inside the set)\n"
+                        "-f {mandelbrot|julia:<re>,<im>|multibrot:<degree>|burning-ship} (fractal, degrees 3 to 8)\n"
+                        "-x <re> -y <im> (center of the view, -0.5 and 0 by default, 0 and 0 for Julia and Multibrot sets, -0.5 and -0.5 for Burning Ship)\n"
+                        "-z <zoom> (magnification of the [-2, 1] x [-1, 1] view, 1 by default)\n"
+                        "-p (perturbation against a high-precision orbit of the center, used automatically for deep zooms)\n"
+                        "-t <size> (write square tiles as separate bitmaps into the output directory)\n"
+                        "-P <levels> (add levels of 2x reductions of the tiles, each into its own subdirectory)\n"
+                        "-c <state> (continue from the iteration counts in the file and save them there, a higher limit only iterates pixels that had not escaped)\n"
+                        "-m {linear|sqrt|log} (mapping of iteration counts to gray levels, linear by default)\n"
+                        "-a <frames> (write a zoom sequence of numbered frames into the output directory)\n"
+                        "-Z <zoom> (zoom of the last frame, the sequence zooms geometrically from -z to it)\n"
+                        "-r (take counts from uniform areas of the previous frame instead of iterating, a few pixels may differ)\n"
+                        "-v (print iterations, their rate, pixels at the limit and time per row or tile and per thread)\n"
+                        "-H <heatmap> (write iterations per 16x16 block as a bitmap, through the -m mapping)");
         return 1;
     }
 
     uint_fast32_t width = atoi(argv[1]);
     uint_fast32_t height = atoi(argv[2]);
-    uint_fast16_t maxIterations = atoi(argv[4]);
-    if (width < 1 || height < 1 || maxIterations < 4)
+    long maxIterations = atol(argv[4]);
+    if (!endZoom)
+        endZoom = zoom;
+    // Worker processes already spread the load over the cores
+    if (!threads)
+        threads = workers ? 1 : sysconf(_SC_NPROCESSORS_ONLN);
+    if (width < 1 || height < 1 || maxIterations < 4 || threads < 1 || minimumTile < 0 || minimumTile == 1 || !(zoom > 0) ||
+        frames < 0 || !(endZoom > 0))
     {
         fprintf(stderr, "At least one numerical value is too small");
         return 1;
     }
+    if (tileSize % 2 || (tileSize && tileSize < 16) || levels < 0 || (levels && !tileSize))
+    {
+        fprintf(stderr, "Tiles must be even and at least 16 pixels, pyramid levels need tiles");
+        return 1;
+    }
+    if (levels >= MAX_LEVELS)
+        levels = MAX_LEVELS - 1;
+    ColorMap colorMap = selectColorMap(colorMapName);
+    if (!colorMap)
+    {
+        fprintf(stderr, "Color mapping is unknown");
+        return 1;
+    }
+    if (statePath && (tileSize || minimumTile || perturbation || zoom > PERTURBATION_ZOOM))
+    {
+        fprintf(stderr, "State file works with whole rows of a plain image only, without -t, -s or perturbation");
+        return 1;
+    }
+    if (workers < 0 || workers > MAX_THREADS || (workers && (tileSize || frames || statePath)))
+    {
+        fprintf(stderr, "Worker processes render a single image, up to %d of them, without -t, -a or -c", MAX_THREADS);
+        return 1;
+    }
+    if ((verbose || heatmapPath) && (workers || frames))
+    {
+        fprintf(stderr, "Statistics and heatmap cover a single render in this process, without -w or -a");
+        return 1;
+    }
+    if (reuse && !frames)
+    {
+        fprintf(stderr, "Reusing the previous frame needs a frame sequence");
+        return 1;
+    }
+    if (frames && (tileSize || minimumTile || statePath))
+    {
+        fprintf(stderr, "Frame sequence renders whole frames only, without -t, -s or -c");
+        return 1;
+    }
+    if (frames && bmpHeadersLength(BMP_GRAY8) + bmpRowLength(width, BMP_GRAY8) * height > UINT32_MAX)
+    {
+        fprintf(stderr, "Frames do not fit into 32-bit bitmap size fields");
+        return 1;
+    }
+    if (maxIterations > UINT16_MAX)
+    {
+        fprintf(stderr, "Max number of iterations does not fit into 16 bits");
+        return 1;
+    }
 
-    FILE *output = fopen(argv[3], "w");
-    if (!output)
+    Formula formula;
+    if (!parseFormula(formulaName, &formula))
     {
-        fprintf(stderr, "Failed to access the output file");
+        fprintf(stderr, "Fractal formula is unknown");
         return 1;
     }
 
-    uint_fast32_t rowLength = ceil(BITS_PER_PIXEL * width / 32) * 4;
-    writeHeaders(width, height, rowLength, output);
-    writePixels(width, height, rowLength, output, maxIterations);
+    // Center is kept in double-double for the reference orbit, the other kernels round it
+    DoubleDouble re = {formula.centerRe, 0}, im = {formula.centerIm, 0};
+    if ((centerRe && !parseDoubleDouble(centerRe, &re)) || (centerIm && !parseDoubleDouble(centerIm, &im)))
+    {
+        fprintf(stderr, "Center coordinates are not decimal numbers within the range of doubles");
+        return 1;
+    }
+    // Frames share the reference orbit of the center, so the whole sequence uses perturbation
+    double deepestZoom = frames && endZoom > zoom ? endZoom : zoom;
+    if (deepestZoom > PERTURBATION_ZOOM)
+        perturbation = true;
+    if (perturbation && deepestZoom > MAX_PERTURBATION_ZOOM)
+        fprintf(stderr, "Zoom is past the precision of the reference orbit, the image will be distorted\n");
+    if (formula.kernel && (perturbation || statePath || kernelName))
+    {
+        fprintf(stderr, "Perturbation, state file and kernel choice are only available for the Mandelbrot set");
+        return 1;
+    }
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
 
-    fclose(output);
+    RowKernel kernel = formula.kernel ? formula.kernel : perturbation ? rowPerturbation : selectKernel(kernelName);
+    if (!kernel)
+    {
+        fprintf(stderr, "Kernel is unknown or not supported by the processor");
+        return 1;
+    }
+
+    Scene scene = {.width = width, .height = height, .maxIterations = maxIterations, .shortcuts = shortcuts,
+                   .juliaRe = formula.juliaRe, .juliaIm = formula.juliaIm};
+    scene.spanRe = DEFAULT_SPAN_RE / zoom;
+    scene.spanIm = DEFAULT_SPAN_IM / zoom;
+    scene.minRe = re.hi - scene.spanRe / 2;
+    scene.minIm = im.hi - scene.spanIm / 2;
+
+    Orbit orbit = {0};
+    if (perturbation)
+    {
+        if (!computeOrbit(&orbit, re, im, maxIterations))
+        {
+            fprintf(stderr, "Failed to allocate memory for the reference orbit");
+            return 1;
+        }
+        // Bulb and cycle tests work on absolute coordinates, which are not resolved at this zoom
+        scene.shortcuts = false;
+        scene.reference = &orbit;
+    }
+
+    IterationState state;
+    const char *error = statePath ? stateLoad(&state, statePath, &scene) : NULL;
+    if (error)
+    {
+        fprintf(stderr, "%s", error);
+        return 1;
+    }
+    bool raised = statePath && (!state.loaded || maxIterations > state.header.maxIterations);
+
+    TileOutput tiles = {.directory = argv[3], .tileSize = tileSize, .levels = levels};
+    RenderStats stats = {.heatmap = heatmapPath != NULL};
+    RenderOptions options = {.threads = threads, .minimumTile = minimumTile > SUBDIVISION_TILE ? SUBDIVISION_TILE : minimumTile,
+                             .tiles = tileSize ? &tiles : NULL, .state = statePath ? &state : NULL, .colorMap = colorMap,
+                             .stats = verbose || heatmapPath ? &stats : NULL};
+    uint_fast64_t computed = 0;
+    Animation animation = {.directory = argv[3], .frames = frames, .centerRe = re.hi, .centerIm = im.hi,
+                           .startZoom = zoom, .endZoom = endZoom, .reuse = reuse};
+    if (workers)
+        error = renderFarm(argv[3], &scene, kernel, &options, workers, &computed);
+    else if (frames)
+        error = renderAnimation(&animation, &scene, kernel, &options, &computed) ? NULL : "Failed to write the frames";
+    else if (tileSize)
+        error = renderImage(NULL, &scene, kernel, &options, &computed) ? NULL : "Failed to write the tiles";
+    else
+        error = renderFile(argv[3], &scene, kernel, &options, &computed);
+    releaseOrbit(&orbit);
+
+    // A lower limit only recolors, the state keeps the counts of the highest one
+    if (!error && raised)
+    {
+        state.header.maxIterations = maxIterations;
+        error = stateSave(&state, statePath) ? NULL : "Failed to write the state file";
+    }
+    if (statePath)
+        stateRelease(&state);
+    if (!error && heatmapPath && !statsWriteHeatmap(&stats, heatmapPath, colorMap))
+        error = "Failed to write the heatmap";
+    if (!error && verbose)
+        statsPrint(&stats, &scene);
+    if (options.stats)
+        statsRelease(&stats);
+
+    if (error)
+    {
+        fprintf(stderr, "%s", error);
+        return 1;
+    }
+    if (minimumTile || statePath || frames)
+        printf("Computed %.2f%% of pixels\n", 100.0 * computed / ((double)width * height * (frames ? frames : 1)));
     return 0;
 }
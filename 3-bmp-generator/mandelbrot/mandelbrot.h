@@ -0,0 +1,261 @@
+#ifndef MANDELBROT_H
+#define MANDELBROT_H
+
+#include "../../lib/bmp.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_THREADS 256
+// Top-level tiles of the subdivision mode, each one is a task for the threads
+#define SUBDIVISION_TILE 128
+// Pyramid levels of the tiled output including full resolution
+#define MAX_LEVELS 33
+// Pixels per side of a heatmap cell
+#define HEATMAP_BLOCK 16
+
+// Default view is [-2, 1] x [-1, 1] at zoom 1
+#define DEFAULT_CENTER_RE -0.5
+#define DEFAULT_CENTER_IM 0.0
+#define DEFAULT_SPAN_RE 3.0
+#define DEFAULT_SPAN_IM 2.0
+// Pixel offsets stop being representable around the center in plain doubles
+#define PERTURBATION_ZOOM 1e12
+// Reference orbit loses precision beyond this
+#define MAX_PERTURBATION_ZOOM 1e28
+
+typedef struct DoubleDouble
+{
+    double hi;
+    double lo;
+} DoubleDouble;
+
+// High-precision reference orbit rounded to doubles, starts with z = 0
+typedef struct Orbit
+{
+    double *re;
+    double *im;
+    uint32_t length;
+} Orbit;
+
+typedef struct Scene
+{
+    uint32_t width;
+    uint32_t height;
+    uint_fast16_t maxIterations;
+    // Skip points known to be inside the set, output stays the same
+    bool shortcuts;
+    // Pixel (x, y) is at (minRe + x * spanRe / width, minIm + y * spanIm / height)
+    double minRe;
+    double minIm;
+    double spanRe;
+    double spanIm;
+    // Orbit of the center for perturbation, NULL otherwise
+    const Orbit *reference;
+    // Constant of Julia sets
+    double juliaRe;
+    double juliaIm;
+} Scene;
+
+static inline double mapX(const Scene *scene, uint32_t x)
+{
+    return (double)x * scene->spanRe / scene->width + scene->minRe;
+}
+
+static inline double mapY(const Scene *scene, uint32_t y)
+{
+    return (double)y * scene->spanIm / scene->height + scene->minIm;
+}
+
+// Iterations before escape for pixels [x, x + count) of row y
+// and, unless finalZ is NULL, the final z of each of them as re/im pairs: the value after maxIterations
+// for points still bounded, NaN for points known to never escape, anything for escaped ones.
+// Returns the number of iterations it performed
+typedef uint_fast64_t (*RowKernel)(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations, double *finalZ);
+// Same for pixels [y, y + count) of column x, without final z
+typedef uint_fast64_t (*ColumnKernel)(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations);
+
+// Both add the iterations they perform to work
+uint_fast16_t getIterations(const Scene *scene, uint32_t x, uint32_t y, double *finalZ, uint_fast64_t *work);
+// Continues a point from its final z at a lower limit, z is updated the same way
+uint_fast16_t resumeIterations(const Scene *scene, uint32_t x, uint32_t y, uint_fast16_t start, double *z, uint_fast64_t *work);
+// Kernel by name (scalar, avx2, avx512) or the widest one the processor supports for NULL,
+// returns NULL when the requested one is unknown or not supported
+RowKernel selectKernel(const char *name);
+// Column kernel giving the same counts as a Mandelbrot row kernel, NULL for any other kernel
+ColumnKernel selectColumnKernel(RowKernel kernel);
+
+// Multibrot degrees with a kernel of their own, degree 2 is the Mandelbrot set
+#define MIN_DEGREE 3
+#define MAX_DEGREE 8
+
+typedef struct Formula
+{
+    // NULL for the Mandelbrot set, which has its own vector kernels
+    RowKernel kernel;
+    // Default center of the view
+    double centerRe;
+    double centerIm;
+    double juliaRe;
+    double juliaIm;
+} Formula;
+
+// Accepts mandelbrot, julia:<re>,<im>, multibrot:<degree> and burning-ship
+bool parseFormula(const char *text, Formula *formula);
+
+bool parseDoubleDouble(const char *text, DoubleDouble *value);
+bool computeOrbit(Orbit *orbit, DoubleDouble cRe, DoubleDouble cIm, uint_fast16_t maxIterations);
+void releaseOrbit(Orbit *orbit);
+// Deep zoom kernel iterating pixel differences from the reference orbit
+uint_fast64_t rowPerturbation(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations, double *finalZ);
+
+// Tiled output: tiles are written as separate bitmaps <directory>/<level>/<x>_<y>.bmp,
+// level 0 is full resolution and every further level halves the one below
+typedef struct TileOutput
+{
+    const char *directory;
+    // Even, so that 2x2 blocks never cross tile borders
+    uint32_t tileSize;
+    uint_fast8_t levels;
+} TileOutput;
+
+// Pyramid tile that still waits for some of its four children
+typedef struct PendingTile
+{
+    uint32_t x;
+    uint32_t y;
+    uint_fast8_t children;
+    uint_fast8_t expected;
+    BmpImage image;
+    struct PendingTile *next;
+} PendingTile;
+
+typedef struct Pyramid
+{
+    TileOutput output;
+    uint32_t width[MAX_LEVELS];
+    uint32_t height[MAX_LEVELS];
+    uint32_t tilesX[MAX_LEVELS];
+    uint32_t tilesY[MAX_LEVELS];
+    pthread_mutex_t lock;
+    PendingTile *pending[MAX_LEVELS];
+} Pyramid;
+
+// Creates the level directories, levels are capped where the image shrinks to a single pixel
+bool pyramidOpen(Pyramid *pyramid, const TileOutput *output, uint32_t width, uint32_t height);
+// Writes a finished tile and adds its reduction to the parent, which is written once complete
+bool pyramidAddTile(Pyramid *pyramid, uint_fast8_t level, uint32_t x, uint32_t y, const BmpImage *tile);
+void pyramidClose(Pyramid *pyramid);
+
+#define STATE_FILE_TYPE 0x5453424D // "MBST"
+
+typedef struct __attribute__((packed)) StateHeader
+{
+    uint32_t type;
+    uint32_t width;
+    uint32_t height;
+    uint32_t maxIterations;
+    double minRe;
+    double minIm;
+    double spanRe;
+    double spanIm;
+} StateHeader;
+
+// Iteration counts of the whole image, followed on disk by the final z of every pixel
+// that reached maxIterations, row by row
+typedef struct IterationState
+{
+    StateHeader header;
+    uint16_t *iterations;
+    // Re/im pairs of the pixels at maxIterations in each row, NULL for rows without any
+    double **finalZ;
+    // Whether the counts came from a file, a new state has none
+    bool loaded;
+} IterationState;
+
+// Loads the state of the scene from path, or starts a new one when there is no such file.
+// Returns an error message or NULL
+const char *stateLoad(IterationState *state, const char *path, const Scene *scene);
+bool stateSave(const IterationState *state, const char *path);
+void stateRelease(IterationState *state);
+
+// Gray level of a pixel
+typedef uint_fast8_t (*ColorMap)(uint_fast16_t n, uint_fast16_t max);
+
+// Measurements of a single render, filled by it
+typedef struct RenderStats
+{
+    // Set by the caller for iterations per HEATMAP_BLOCK square of the scene, row by row
+    bool heatmap;
+    uint64_t *cost;
+    uint32_t costWidth;
+    uint32_t costHeight;
+    uint_fast64_t iterations;
+    // Pixels at maxIterations
+    uint_fast64_t bounded;
+    double seconds;
+    // Wall time of every task, row by row over the tile grid
+    double *tileSeconds;
+    uint32_t tileWidth;
+    uint32_t tileHeight;
+    uint32_t tilesX;
+    uint32_t tilesY;
+    // Time spent on tasks and tasks done by every thread that took part
+    uint_fast16_t threads;
+    double threadSeconds[MAX_THREADS];
+    uint32_t threadTiles[MAX_THREADS];
+} RenderStats;
+
+void statsPrint(const RenderStats *stats, const Scene *scene);
+// Gray levels scaled to the most expensive cell
+bool statsWriteHeatmap(const RenderStats *stats, const char *path, ColorMap colorMap);
+void statsRelease(RenderStats *stats);
+
+typedef struct RenderOptions
+{
+    uint_fast16_t threads;
+    // Smallest rectangle split by the subdivision mode, 0 evaluates every pixel
+    uint_fast16_t minimumTile;
+    // Tiles to write instead of the image, NULL renders into the image
+    const TileOutput *tiles;
+    // Counts to continue from and to update, whole rows only, NULL iterates from scratch
+    IterationState *state;
+    ColorMap colorMap;
+    // Rows [firstRow, firstRow + rowCount) of the scene are rendered into the rows of the image,
+    // 0 renders all of them. Ranges start on a tile border for the same result as a whole render
+    uint32_t firstRow;
+    uint32_t rowCount;
+    // Measurements to fill, NULL skips them
+    RenderStats *stats;
+} RenderOptions;
+
+uint_fast8_t mapIterationsToColor(uint_fast16_t n, uint_fast16_t max);
+// Linear by default, sqrt and log bring out the few high counts, NULL when unknown
+ColorMap selectColorMap(const char *name);
+// Stores the number of pixels that were evaluated rather than filled, image is unused for tiled output
+bool renderImage(BmpImage *image, const Scene *scene, RowKernel kernel, const RenderOptions *options, uint_fast64_t *computed);
+
+// Frames zooming geometrically from the start to the end zoom around a fixed center,
+// written as <directory>/<frame>.bmp
+typedef struct Animation
+{
+    const char *directory;
+    uint32_t frames;
+    double centerRe;
+    double centerIm;
+    double startZoom;
+    double endZoom;
+    // Pixels lying in a uniform neighbourhood of the previous frame take its count without iterating
+    bool reuse;
+} Animation;
+
+// Whole frames are the tasks for the threads, scene gives everything but the view
+bool renderAnimation(const Animation *animation, const Scene *scene, RowKernel kernel, const RenderOptions *options, uint_fast64_t *computed);
+
+// Renders with worker processes that each take ranges of rows from the coordinator and write them
+// straight into the output file. Ranges of dead workers go to the others. Returns an error message or NULL
+const char *renderFarm(const char *path, const Scene *scene, RowKernel kernel, const RenderOptions *options, uint_fast16_t workers,
+                       uint_fast64_t *computed);
+
+#endif
@@ -0,0 +1,187 @@
+#include "mandelbrot.h"
+
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Error-free transformations below rely on every operation being rounded on its own
+#pragma GCC optimize("fp-contract=off")
+
+// Double-double arithmetic: value is hi + lo with |lo| <= ulp(hi) / 2, about 32 significant digits
+
+static inline DoubleDouble quickTwoSum(double a, double b)
+{
+    double sum = a + b;
+    return (DoubleDouble){sum, b - (sum - a)};
+}
+
+static inline DoubleDouble twoSum(double a, double b)
+{
+    double sum = a + b;
+    double bb = sum - a;
+    return (DoubleDouble){sum, (a - (sum - bb)) + (b - bb)};
+}
+
+static inline DoubleDouble ddAdd(DoubleDouble a, DoubleDouble b)
+{
+    DoubleDouble sum = twoSum(a.hi, b.hi);
+    DoubleDouble low = twoSum(a.lo, b.lo);
+    sum = quickTwoSum(sum.hi, sum.lo + low.hi);
+    return quickTwoSum(sum.hi, sum.lo + low.lo);
+}
+
+static inline DoubleDouble ddMul(DoubleDouble a, DoubleDouble b)
+{
+    double product = a.hi * b.hi;
+    double error = fma(a.hi, b.hi, -product);
+    return quickTwoSum(product, error + (a.hi * b.lo + a.lo * b.hi));
+}
+
+static inline DoubleDouble ddMulDouble(DoubleDouble a, double b)
+{
+    double product = a.hi * b;
+    double error = fma(a.hi, b, -product);
+    return quickTwoSum(product, error + a.lo * b);
+}
+
+static inline DoubleDouble ddDivDouble(DoubleDouble a, double b)
+{
+    double quotient = a.hi / b;
+    DoubleDouble remainder = ddAdd(a, ddMulDouble((DoubleDouble){quotient, 0}, -b));
+    return quickTwoSum(quotient, remainder.hi / b);
+}
+
+bool parseDoubleDouble(const char *text, DoubleDouble *value)
+{
+    DoubleDouble result = {0, 0};
+    bool negative = *text == '-';
+    if (*text == '-' || *text == '+')
+        text++;
+
+    long decimals = 0;
+    bool fraction = false, digits = false;
+    for (; isdigit(*text) || (*text == '.' && !fraction); text++)
+    {
+        if (*text == '.')
+        {
+            fraction = true;
+            continue;
+        }
+        result = ddAdd(ddMulDouble(result, 10), (DoubleDouble){*text - '0', 0});
+        decimals += fraction;
+        digits = true;
+    }
+    if (*text == 'e' || *text == 'E')
+    {
+        char *end;
+        long exponent = strtol(text + 1, &end, 10);
+        // No value within the range of doubles needs an exponent beyond it, which also bounds the scaling below
+        if (end == text + 1 || exponent > DBL_MAX_10_EXP - DBL_MIN_10_EXP || exponent < DBL_MIN_10_EXP - DBL_MAX_10_EXP)
+            return false;
+        decimals -= exponent;
+        text = end;
+    }
+    if (!digits || *text)
+        return false;
+
+    for (; decimals > 0; decimals--)
+        result = ddDivDouble(result, 10);
+    for (; decimals < 0; decimals++)
+        result = ddMulDouble(result, 10);
+    // Values too large for doubles end up infinite or NaN, too small ones just lose their digits
+    if (!isfinite(result.hi))
+        return false;
+
+    *value = negative ? (DoubleDouble){-result.hi, -result.lo} : result;
+    return true;
+}
+
+bool computeOrbit(Orbit *orbit, DoubleDouble cRe, DoubleDouble cIm, uint_fast16_t maxIterations)
+{
+    orbit->re = malloc(((size_t)maxIterations + 1) * sizeof(double));
+    orbit->im = malloc(((size_t)maxIterations + 1) * sizeof(double));
+    if (!orbit->re || !orbit->im)
+    {
+        releaseOrbit(orbit);
+        return false;
+    }
+
+    DoubleDouble re = {0, 0}, im = {0, 0};
+    orbit->re[0] = orbit->im[0] = 0;
+    orbit->length = 1;
+    for (uint_fast16_t i = 0; i < maxIterations; i++)
+    {
+        DoubleDouble nextRe = ddAdd(ddAdd(ddMul(re, re), ddMul((DoubleDouble){-im.hi, -im.lo}, im)), cRe);
+        im = ddAdd(ddMulDouble(ddMul(re, im), 2), cIm);
+        re = nextRe;
+
+        orbit->re[orbit->length] = re.hi;
+        orbit->im[orbit->length] = im.hi;
+        orbit->length++;
+        // Escaped reference is still usable up to here, pixels rebase when they reach its end
+        if (re.hi * re.hi + im.hi * im.hi > 4)
+            break;
+    }
+    return true;
+}
+
+void releaseOrbit(Orbit *orbit)
+{
+    free(orbit->re);
+    free(orbit->im);
+    orbit->re = orbit->im = NULL;
+}
+
+// Every pixel iterates its difference from the reference orbit in plain doubles:
+// delta' = (2 Z + delta) delta + deltaC, where deltaC is the offset of the pixel from the center.
+// Once the full value gets smaller than the difference, precision of the difference is about
+// to be lost (a glitch), so the pixel rebases onto the start of the reference with delta = z.
+// The same happens at the end of an escaped reference
+static uint_fast16_t getDeltaIterations(const Scene *scene, double deltaCRe, double deltaCIm)
+{
+    const Orbit *orbit = scene->reference;
+    double deltaRe = 0, deltaIm = 0;
+    uint32_t n = 0;
+
+    for (uint_fast16_t i = 0; i < scene->maxIterations; i++)
+    {
+        double twoZRe = 2 * orbit->re[n] + deltaRe;
+        double twoZIm = 2 * orbit->im[n] + deltaIm;
+        double nextRe = twoZRe * deltaRe - twoZIm * deltaIm + deltaCRe;
+        deltaIm = twoZRe * deltaIm + twoZIm * deltaRe + deltaCIm;
+        deltaRe = nextRe;
+        n++;
+
+        double re = orbit->re[n] + deltaRe;
+        double im = orbit->im[n] + deltaIm;
+        double magnitude = re * re + im * im;
+        if (magnitude > 4)
+            return i;
+
+        if (magnitude < deltaRe * deltaRe + deltaIm * deltaIm || n == orbit->length - 1)
+        {
+            deltaRe = re;
+            deltaIm = im;
+            n = 0;
+        }
+    }
+    return scene->maxIterations;
+}
+
+uint_fast64_t rowPerturbation(const Scene *scene, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations, double *finalZ)
+{
+    // Absolute z is not precise enough to continue from at deep zoom
+    (void)finalZ;
+    // Offsets from the center are small enough for doubles at any zoom
+    double deltaCIm = (double)y * scene->spanIm / scene->height - scene->spanIm / 2;
+    uint_fast64_t work = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        double deltaCRe = (double)(x + i) * scene->spanRe / scene->width - scene->spanRe / 2;
+        iterations[i] = getDeltaIterations(scene, deltaCRe, deltaCIm);
+        // There is no cycle test, so a pixel escaping at i took one step more
+        work += iterations[i] < scene->maxIterations ? iterations[i] + 1u : scene->maxIterations;
+    }
+    return work;
+}
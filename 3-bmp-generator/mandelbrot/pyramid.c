@@ -0,0 +1,161 @@
+#include "mandelbrot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool makeDirectory(const char *path)
+{
+    return !mkdir(path, 0755) || errno == EEXIST;
+}
+
+bool pyramidOpen(Pyramid *pyramid, const TileOutput *output, uint32_t width, uint32_t height)
+{
+    *pyramid = (Pyramid){.output = *output};
+    if (!makeDirectory(output->directory))
+        return false;
+
+    uint32_t tileSize = output->tileSize;
+    uint_fast8_t level = 0;
+    for (;; level++)
+    {
+        pyramid->width[level] = width;
+        pyramid->height[level] = height;
+        pyramid->tilesX[level] = (width + tileSize - 1) / tileSize;
+        pyramid->tilesY[level] = (height + tileSize - 1) / tileSize;
+
+        char path[PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%u", output->directory, (unsigned)level) >= (int)sizeof(path) || !makeDirectory(path))
+            return false;
+
+        if (level == output->levels || (width == 1 && height == 1))
+            break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+    pyramid->output.levels = level;
+    return !pthread_mutex_init(&pyramid->lock, NULL);
+}
+
+static bool writeTile(const Pyramid *pyramid, uint_fast8_t level, uint32_t x, uint32_t y, const BmpImage *tile)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%u/%u_%u.bmp", pyramid->output.directory, (unsigned)level, (unsigned)x, (unsigned)y);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool written = bmpWrite(fd, tile);
+    return !close(fd) && written;
+}
+
+// Box filter into the quarter of the parent covered by the child, odd edges average fewer pixels
+static void reduce(const BmpImage *child, BmpImage *parent, uint32_t offsetX, uint32_t offsetY)
+{
+    for (uint32_t y = 0; y < (child->height + 1) / 2; y++)
+    {
+        const uint8_t *top = bmpRow(child, 2 * y);
+        const uint8_t *bottom = 2 * y + 1 < child->height ? bmpRow(child, 2 * y + 1) : top;
+        uint8_t *row = bmpRow(parent, offsetY + y) + offsetX;
+        for (uint32_t x = 0; x < child->width / 2; x++)
+        {
+            row[x] = (top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) / 4;
+        }
+        if (child->width % 2)
+        {
+            uint32_t x = child->width / 2;
+            row[x] = (top[2 * x] + bottom[2 * x] + 1) / 2;
+        }
+    }
+}
+
+// Finds the parent of a tile on the level above, or starts it with zeroed padding
+static PendingTile *acquireParent(Pyramid *pyramid, uint_fast8_t level, uint32_t x, uint32_t y)
+{
+    PendingTile *parent = pyramid->pending[level];
+    while (parent && (parent->x != x || parent->y != y))
+    {
+        parent = parent->next;
+    }
+    if (parent)
+        return parent;
+
+    parent = malloc(sizeof(PendingTile));
+    uint32_t tileSize = pyramid->output.tileSize;
+    uint32_t width = pyramid->width[level] - x * tileSize < tileSize ? pyramid->width[level] - x * tileSize : tileSize;
+    uint32_t height = pyramid->height[level] - y * tileSize < tileSize ? pyramid->height[level] - y * tileSize : tileSize;
+    if (!parent || !bmpAllocate(&parent->image, width, height, BMP_GRAY8))
+    {
+        free(parent);
+        return NULL;
+    }
+
+    uint32_t childrenX = pyramid->tilesX[level - 1] - 2 * x < 2 ? 1 : 2;
+    uint32_t childrenY = pyramid->tilesY[level - 1] - 2 * y < 2 ? 1 : 2;
+    parent->x = x;
+    parent->y = y;
+    parent->children = 0;
+    parent->expected = childrenX * childrenY;
+    parent->next = pyramid->pending[level];
+    pyramid->pending[level] = parent;
+    return parent;
+}
+
+// Tiles finish in Z-order, so only parents of tiles currently in flight stay pending
+// and memory depends on tile size, threads and levels rather than on the image size
+bool pyramidAddTile(Pyramid *pyramid, uint_fast8_t level, uint32_t x, uint32_t y, const BmpImage *tile)
+{
+    if (!writeTile(pyramid, level, x, y, tile))
+        return false;
+    if (level == pyramid->output.levels)
+        return true;
+
+    pthread_mutex_lock(&pyramid->lock);
+    PendingTile *parent = acquireParent(pyramid, level + 1, x / 2, y / 2);
+    pthread_mutex_unlock(&pyramid->lock);
+    if (!parent)
+        return false;
+
+    // Children fill disjoint quarters, the lock below publishes them to whoever completes the parent
+    uint32_t half = pyramid->output.tileSize / 2;
+    reduce(tile, &parent->image, x % 2 * half, y % 2 * half);
+
+    pthread_mutex_lock(&pyramid->lock);
+    bool complete = ++parent->children == parent->expected;
+    if (complete)
+    {
+        PendingTile **link = &pyramid->pending[level + 1];
+        while (*link != parent)
+        {
+            link = &(*link)->next;
+        }
+        *link = parent->next;
+    }
+    pthread_mutex_unlock(&pyramid->lock);
+    if (!complete)
+        return true;
+
+    bool added = pyramidAddTile(pyramid, level + 1, x / 2, y / 2, &parent->image);
+    bmpRelease(&parent->image);
+    free(parent);
+    return added;
+}
+
+void pyramidClose(Pyramid *pyramid)
+{
+    // Only left behind when rendering failed
+    for (uint_fast8_t level = 0; level <= pyramid->output.levels; level++)
+    {
+        while (pyramid->pending[level])
+        {
+            PendingTile *next = pyramid->pending[level]->next;
+            bmpRelease(&pyramid->pending[level]->image);
+            free(pyramid->pending[level]);
+            pyramid->pending[level] = next;
+        }
+    }
+    pthread_mutex_destroy(&pyramid->lock);
+}
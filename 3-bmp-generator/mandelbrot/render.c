@@ -0,0 +1,539 @@
+#include "mandelbrot.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct Render
+{
+    BmpImage *image;
+    Scene scene;
+    RowKernel kernel;
+    // Evaluates the sides of subdivision rectangles, NULL for single pixels through the row kernel
+    ColumnKernel columnKernel;
+    uint_fast16_t minimumTile;
+    uint32_t tileWidth;
+    uint32_t tileHeight;
+    uint32_t tilesX;
+    uint32_t tilesY;
+    // Rows of the scene that go into the image
+    uint32_t firstRow;
+    uint32_t endRow;
+    // Tiles are handed out one at a time: tiles through the set cost maxIterations per pixel
+    // while tiles outside of it escape almost immediately, so fixed ranges balance badly
+    uint_fast64_t tiles;
+    atomic_uint_fast64_t nextTile;
+    atomic_uint_fast64_t computed;
+    // Tiled output, handed out in Z-order over a power-of-two grid so that 2x2 blocks finish together
+    Pyramid *pyramid;
+    // Rows continue from and are stored into the state when it is given,
+    // it is only updated when the limit goes up
+    IterationState *state;
+    bool storeState;
+    ColorMap colorMap;
+    atomic_bool failed;
+    // Measurements, NULL unless requested. Each thread takes its own slot
+    RenderStats *stats;
+    atomic_uint_fast64_t iterations;
+    atomic_uint_fast64_t bounded;
+    atomic_uint_fast16_t nextThread;
+} Render;
+
+typedef struct Tile
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+    uint16_t *iterations;
+    // Pixels already evaluated or filled, only tracked when subdividing
+    bool *known;
+    // Counts of a side when subdividing with a column kernel
+    uint16_t *column;
+    uint_fast64_t computed;
+    // Iterations performed, pixels at maxIterations
+    uint_fast64_t work;
+    uint_fast64_t bounded;
+    // Colors of tiled output
+    BmpImage pixels;
+    // Final z of the row when keeping a state
+    double *finalZ;
+} Tile;
+
+uint_fast8_t mapIterationsToColor(uint_fast16_t n, uint_fast16_t max)
+{
+    return (float)n / max * 255;
+}
+
+static uint_fast8_t mapIterationsToColorSqrt(uint_fast16_t n, uint_fast16_t max)
+{
+    return sqrtf((float)n / max) * 255;
+}
+
+static uint_fast8_t mapIterationsToColorLog(uint_fast16_t n, uint_fast16_t max)
+{
+    return log1pf(n) / log1pf(max) * 255;
+}
+
+ColorMap selectColorMap(const char *name)
+{
+    if (!name || !strcmp(name, "linear"))
+        return mapIterationsToColor;
+    if (!strcmp(name, "sqrt"))
+        return mapIterationsToColorSqrt;
+    if (!strcmp(name, "log"))
+        return mapIterationsToColorLog;
+    return NULL;
+}
+
+static double readClock(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Runs the kernel on a span in tile coordinates, split at heatmap cells to charge each one its iterations
+static void runKernel(Render *render, Tile *tile, uint32_t x, uint32_t y, uint32_t count, double *finalZ)
+{
+    size_t offset = (size_t)y * tile->width + x;
+    uint64_t *cost = render->stats ? render->stats->cost : NULL;
+    if (!cost)
+    {
+        tile->work += render->kernel(&render->scene, tile->x + x, tile->y + y, count, tile->iterations + offset, finalZ);
+        return;
+    }
+
+    uint64_t *cells = cost + (size_t)((tile->y + y) / HEATMAP_BLOCK) * render->stats->costWidth;
+    for (uint32_t start = 0; start < count;)
+    {
+        uint32_t column = tile->x + x + start;
+        uint32_t end = (column / HEATMAP_BLOCK + 1) * HEATMAP_BLOCK - (tile->x + x);
+        if (end > count)
+            end = count;
+        uint_fast64_t work = render->kernel(&render->scene, column, tile->y + y, end - start, tile->iterations + offset + start,
+                                            finalZ ? finalZ + 2 * start : NULL);
+        // Rows of a cell may belong to different threads
+        __atomic_fetch_add(&cells[column / HEATMAP_BLOCK], work, __ATOMIC_RELAXED);
+        tile->work += work;
+        start = end;
+    }
+}
+
+// Evaluates unknown pixels of a span in tile coordinates
+static void computeSpan(Render *render, Tile *tile, uint32_t x, uint32_t y, uint32_t count)
+{
+    size_t offset = (size_t)y * tile->width + x;
+    if (!tile->known)
+    {
+        runKernel(render, tile, x, y, count, tile->finalZ ? tile->finalZ + 2 * offset : NULL);
+        tile->computed += count;
+        return;
+    }
+
+    for (uint32_t start = 0; start < count;)
+    {
+        if (tile->known[offset + start])
+        {
+            start++;
+            continue;
+        }
+        uint32_t end = start;
+        while (end < count && !tile->known[offset + end])
+        {
+            end++;
+        }
+        runKernel(render, tile, x + start, y, end - start, NULL);
+        memset(tile->known + offset + start, true, end - start);
+        tile->computed += end - start;
+        start = end;
+    }
+}
+
+// Column counterpart of runKernel, counts go to a buffer of their own
+static void runColumn(Render *render, Tile *tile, uint32_t x, uint32_t y, uint32_t count, uint16_t *iterations)
+{
+    uint64_t *cost = render->stats ? render->stats->cost : NULL;
+    if (!cost)
+    {
+        tile->work += render->columnKernel(&render->scene, tile->x + x, tile->y + y, count, iterations);
+        return;
+    }
+
+    uint64_t *cells = cost + (tile->x + x) / HEATMAP_BLOCK;
+    for (uint32_t start = 0; start < count;)
+    {
+        uint32_t row = tile->y + y + start;
+        uint32_t end = (row / HEATMAP_BLOCK + 1) * HEATMAP_BLOCK - (tile->y + y);
+        if (end > count)
+            end = count;
+        uint_fast64_t work = render->columnKernel(&render->scene, tile->x + x, row, end - start, iterations + start);
+        __atomic_fetch_add(&cells[(size_t)(row / HEATMAP_BLOCK) * render->stats->costWidth], work, __ATOMIC_RELAXED);
+        tile->work += work;
+        start = end;
+    }
+}
+
+// Evaluates unknown pixels of a column span in tile coordinates. Vector kernels fall back to scalar
+// code for single pixels, so sides go through the column kernel in runs when there is one
+static void computeColumn(Render *render, Tile *tile, uint32_t x, uint32_t y, uint32_t count)
+{
+    if (!render->columnKernel)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            computeSpan(render, tile, x, y + i, 1);
+        }
+        return;
+    }
+
+    for (uint32_t start = 0; start < count;)
+    {
+        if (tile->known[(size_t)(y + start) * tile->width + x])
+        {
+            start++;
+            continue;
+        }
+        uint32_t end = start;
+        while (end < count && !tile->known[(size_t)(y + end) * tile->width + x])
+        {
+            end++;
+        }
+        runColumn(render, tile, x, y + start, end - start, tile->column);
+        for (uint32_t i = start; i < end; i++)
+        {
+            size_t offset = (size_t)(y + i) * tile->width + x;
+            tile->iterations[offset] = tile->column[i - start];
+            tile->known[offset] = true;
+        }
+        tile->computed += end - start;
+        start = end;
+    }
+}
+
+// Mariani-Silver: a rectangle with the same count all along its border is filled with it,
+// otherwise it is split in four down to the minimum size. Edges are inclusive
+static void subdivide(Render *render, Tile *tile, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    uint32_t width = x1 - x0 + 1;
+    computeSpan(render, tile, x0, y0, width);
+    computeSpan(render, tile, x0, y1, width);
+    if (y1 > y0 + 1)
+    {
+        computeColumn(render, tile, x0, y0 + 1, y1 - y0 - 1);
+        computeColumn(render, tile, x1, y0 + 1, y1 - y0 - 1);
+    }
+
+    uint16_t *iterations = tile->iterations;
+    uint16_t value = iterations[(size_t)y0 * tile->width + x0];
+    bool uniform = true;
+    for (uint32_t x = x0; uniform && x <= x1; x++)
+    {
+        uniform = iterations[(size_t)y0 * tile->width + x] == value && iterations[(size_t)y1 * tile->width + x] == value;
+    }
+    for (uint32_t y = y0 + 1; uniform && y < y1; y++)
+    {
+        uniform = iterations[(size_t)y * tile->width + x0] == value && iterations[(size_t)y * tile->width + x1] == value;
+    }
+
+    if (uniform)
+    {
+        for (uint32_t y = y0 + 1; y < y1; y++)
+        {
+            size_t offset = (size_t)y * tile->width;
+            for (uint32_t x = x0 + 1; x < x1; x++)
+            {
+                iterations[offset + x] = value;
+            }
+            if (x1 > x0 + 1)
+                memset(tile->known + offset + x0 + 1, true, x1 - x0 - 1);
+        }
+        return;
+    }
+
+    if (width <= render->minimumTile || y1 - y0 + 1 <= render->minimumTile)
+    {
+        // A single column has no inside, its pixels are all on the border
+        for (uint32_t y = y0 + 1; x1 > x0 + 1 && y < y1; y++)
+        {
+            computeSpan(render, tile, x0 + 1, y, width - 2);
+        }
+        return;
+    }
+
+    uint32_t xm = (x0 + x1) / 2;
+    uint32_t ym = (y0 + y1) / 2;
+    subdivide(render, tile, x0, y0, xm, ym);
+    subdivide(render, tile, xm, y0, x1, ym);
+    subdivide(render, tile, x0, ym, xm, y1);
+    subdivide(render, tile, xm, ym, x1, y1);
+}
+
+// Only pixels still bounded at the saved limit are iterated further, from their saved z
+static void resumeRow(Render *render, Tile *tile)
+{
+    const IterationState *state = render->state;
+    const uint16_t *saved = state->iterations + (size_t)tile->y * tile->width;
+    const double *z = state->finalZ[tile->y];
+    uint_fast16_t limit = state->header.maxIterations;
+    uint_fast16_t maxIterations = render->scene.maxIterations;
+    uint64_t *cells = render->stats && render->stats->cost ? render->stats->cost + (size_t)(tile->y / HEATMAP_BLOCK) * render->stats->costWidth
+                                                           : NULL;
+
+    for (uint32_t x = 0; x < tile->width; x++)
+    {
+        if (saved[x] < limit || maxIterations <= limit)
+        {
+            tile->iterations[x] = saved[x] < maxIterations ? saved[x] : maxIterations;
+        }
+        else
+        {
+            tile->finalZ[2 * x] = z[0];
+            tile->finalZ[2 * x + 1] = z[1];
+            uint_fast64_t work = 0;
+            tile->iterations[x] = resumeIterations(&render->scene, x, tile->y, limit, tile->finalZ + 2 * x, &work);
+            tile->work += work;
+            if (cells)
+                __atomic_fetch_add(&cells[x / HEATMAP_BLOCK], work, __ATOMIC_RELAXED);
+            // Points known to stay inside are not iterated again
+            tile->computed += !isnan(z[0]);
+        }
+        if (saved[x] == limit)
+            z += 2;
+    }
+}
+
+static bool storeRow(Render *render, Tile *tile)
+{
+    IterationState *state = render->state;
+    memcpy(state->iterations + (size_t)tile->y * tile->width, tile->iterations, tile->width * sizeof(uint16_t));
+
+    uint32_t bounded = 0;
+    for (uint32_t x = 0; x < tile->width; x++)
+    {
+        bounded += tile->iterations[x] == render->scene.maxIterations;
+    }
+    double *z = bounded ? malloc(bounded * 2 * sizeof(double)) : NULL;
+    if (bounded && !z)
+        return false;
+    for (uint32_t x = 0, i = 0; x < tile->width; x++)
+    {
+        if (tile->iterations[x] == render->scene.maxIterations)
+        {
+            z[i++] = tile->finalZ[2 * x];
+            z[i++] = tile->finalZ[2 * x + 1];
+        }
+    }
+    free(state->finalZ[tile->y]);
+    state->finalZ[tile->y] = z;
+    return true;
+}
+
+static bool renderTile(Render *render, Tile *tile)
+{
+    if (render->state && render->state->loaded)
+    {
+        resumeRow(render, tile);
+    }
+    else if (tile->known)
+    {
+        memset(tile->known, false, (size_t)tile->width * tile->height);
+        subdivide(render, tile, 0, 0, tile->width - 1, tile->height - 1);
+    }
+    else
+    {
+        for (uint32_t y = 0; y < tile->height; y++)
+        {
+            computeSpan(render, tile, 0, y, tile->width);
+        }
+    }
+
+    BmpImage *pixels = &tile->pixels;
+    if (render->pyramid)
+    {
+        pixels->width = tile->width;
+        pixels->height = tile->height;
+        pixels->stride = bmpRowLength(tile->width, BMP_GRAY8);
+    }
+
+    for (uint32_t y = 0; y < tile->height; y++)
+    {
+        uint8_t *row = render->pyramid ? bmpRow(pixels, y) : bmpRow(render->image, tile->y - render->firstRow + y) + tile->x;
+        uint16_t *iterations = tile->iterations + (size_t)y * tile->width;
+        for (uint32_t x = 0; x < tile->width; x++)
+        {
+            row[x] = render->colorMap(iterations[x], render->scene.maxIterations);
+            tile->bounded += iterations[x] == render->scene.maxIterations;
+        }
+        if (render->pyramid)
+            memset(row + tile->width, 0, pixels->stride - tile->width);
+    }
+
+    if (render->storeState && !storeRow(render, tile))
+        return false;
+
+    return !render->pyramid ||
+           pyramidAddTile(render->pyramid, 0, tile->x / render->tileWidth, tile->y / render->tileHeight, pixels);
+}
+
+// Even bits of a Z-order index are the column, odd bits the row
+static uint32_t compactBits(uint_fast64_t index)
+{
+    uint32_t value = 0;
+    for (uint_fast8_t bit = 0; bit < 32; bit++)
+    {
+        value |= (uint32_t)(index >> (2 * bit) & 1) << bit;
+    }
+    return value;
+}
+
+// Returns false for indices outside of the image
+static bool locateTile(const Render *render, uint_fast64_t index, uint32_t *x, uint32_t *y)
+{
+    if (render->pyramid)
+    {
+        *x = compactBits(index);
+        *y = compactBits(index >> 1);
+    }
+    else
+    {
+        *x = index % render->tilesX;
+        *y = index / render->tilesX;
+    }
+    return *x < render->tilesX && *y < render->tilesY;
+}
+
+static void *renderWorker(void *arg)
+{
+    Render *render = arg;
+    size_t pixels = (size_t)render->tileWidth * render->tileHeight;
+    Tile tile = {.iterations = malloc(pixels * sizeof(uint16_t)),
+                 .known = render->minimumTile ? malloc(pixels * sizeof(bool)) : NULL};
+    bool columns = render->minimumTile && render->columnKernel;
+    tile.column = columns ? malloc(render->tileHeight * sizeof(uint16_t)) : NULL;
+    tile.finalZ = render->state ? malloc(pixels * 2 * sizeof(double)) : NULL;
+    bool allocated = tile.iterations && (!render->minimumTile || tile.known) && (!columns || tile.column) && (!render->state || tile.finalZ) &&
+                     (!render->pyramid || bmpAllocate(&tile.pixels, render->tileWidth, render->tileHeight, BMP_GRAY8));
+
+    RenderStats *stats = render->stats;
+    uint_fast16_t thread = stats ? atomic_fetch_add(&render->nextThread, 1) : 0;
+    uint_fast64_t index;
+    while (allocated && !render->failed && (index = atomic_fetch_add(&render->nextTile, 1)) < render->tiles)
+    {
+        uint32_t column, row;
+        if (!locateTile(render, index, &column, &row))
+            continue;
+        tile.x = column * render->tileWidth;
+        tile.y = render->firstRow + row * render->tileHeight;
+        tile.width = render->scene.width - tile.x < render->tileWidth ? render->scene.width - tile.x : render->tileWidth;
+        tile.height = render->endRow - tile.y < render->tileHeight ? render->endRow - tile.y : render->tileHeight;
+        double start = stats ? readClock() : 0;
+        if (!renderTile(render, &tile))
+            render->failed = true;
+        if (stats)
+        {
+            double seconds = readClock() - start;
+            stats->tileSeconds[(size_t)row * render->tilesX + column] = seconds;
+            stats->threadSeconds[thread] += seconds;
+            stats->threadTiles[thread]++;
+        }
+    }
+
+    // Tiled output cannot be completed without every tile, other threads pick up the rows of an image
+    // unless none of them could allocate its buffers either, which renderImage checks
+    if (!allocated && render->pyramid)
+        render->failed = true;
+    atomic_fetch_add(&render->computed, tile.computed);
+    atomic_fetch_add(&render->iterations, tile.work);
+    atomic_fetch_add(&render->bounded, tile.bounded);
+    free(tile.iterations);
+    free(tile.known);
+    free(tile.column);
+    free(tile.finalZ);
+    bmpRelease(&tile.pixels);
+    return NULL;
+}
+
+bool renderImage(BmpImage *image, const Scene *scene, RowKernel kernel, const RenderOptions *options, uint_fast64_t *computed)
+{
+    Render render = {.image = image, .scene = *scene, .kernel = kernel, .columnKernel = selectColumnKernel(kernel),
+                     .minimumTile = options->minimumTile, .state = options->state};
+    render.storeState = render.state && (!render.state->loaded || scene->maxIterations > render.state->header.maxIterations);
+    render.colorMap = options->colorMap ? options->colorMap : mapIterationsToColor;
+    RenderStats *stats = options->stats;
+
+    // Whole rows unless subdividing, which works on square top-level tiles
+    render.tileWidth = options->minimumTile ? SUBDIVISION_TILE : scene->width;
+    render.tileHeight = options->minimumTile ? SUBDIVISION_TILE : 1;
+    Pyramid pyramid;
+    if (options->tiles)
+    {
+        if (!pyramidOpen(&pyramid, options->tiles, scene->width, scene->height))
+            return false;
+        render.pyramid = &pyramid;
+        render.tileWidth = render.tileHeight = options->tiles->tileSize;
+    }
+    render.tilesX = (scene->width + render.tileWidth - 1) / render.tileWidth;
+    render.firstRow = options->rowCount ? options->firstRow : 0;
+    render.endRow = options->rowCount ? options->firstRow + options->rowCount : scene->height;
+    render.tilesY = (render.endRow - render.firstRow + render.tileHeight - 1) / render.tileHeight;
+    render.tiles = (uint_fast64_t)render.tilesX * render.tilesY;
+    if (render.pyramid)
+    {
+        uint_fast64_t side = 1;
+        while (side < render.tilesX || side < render.tilesY)
+        {
+            side *= 2;
+        }
+        render.tiles = side * side;
+    }
+    if (stats)
+    {
+        *stats = (RenderStats){.heatmap = stats->heatmap, .tileWidth = render.tileWidth, .tileHeight = render.tileHeight,
+                               .tilesX = render.tilesX, .tilesY = render.tilesY};
+        stats->tileSeconds = calloc((size_t)render.tilesX * render.tilesY, sizeof(double));
+        // Cells are counted from the first row of the scene
+        stats->costWidth = (scene->width + HEATMAP_BLOCK - 1) / HEATMAP_BLOCK;
+        stats->costHeight = (render.endRow + HEATMAP_BLOCK - 1) / HEATMAP_BLOCK;
+        stats->cost = stats->heatmap ? calloc((size_t)stats->costWidth * stats->costHeight, sizeof(uint64_t)) : NULL;
+        if (!stats->tileSeconds || (stats->heatmap && !stats->cost))
+        {
+            if (render.pyramid)
+                pyramidClose(&pyramid);
+            statsRelease(stats);
+            return false;
+        }
+        render.stats = stats;
+    }
+
+    pthread_t workers[MAX_THREADS];
+
+    // Calling thread renders as well, tiles are shared by whatever threads managed to start
+    double start = readClock();
+    uint_fast16_t started = 0;
+    while (started < options->threads - 1 && !pthread_create(&workers[started], NULL, renderWorker, &render))
+    {
+        started++;
+    }
+    renderWorker(&render);
+
+    for (uint_fast16_t i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    if (render.pyramid)
+        pyramidClose(&pyramid);
+    if (stats)
+    {
+        stats->seconds = readClock() - start;
+        stats->iterations = render.iterations;
+        stats->bounded = render.bounded;
+        stats->threads = render.nextThread;
+    }
+    *computed = render.computed;
+    // Tiles are left over when no thread could allocate its buffers
+    return !render.failed && render.nextTile >= render.tiles;
+}
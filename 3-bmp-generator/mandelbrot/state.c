@@ -0,0 +1,136 @@
+#include "mandelbrot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static uint32_t countBounded(const IterationState *state, uint32_t y)
+{
+    const uint16_t *row = state->iterations + (size_t)y * state->header.width;
+    uint32_t count = 0;
+    for (uint32_t x = 0; x < state->header.width; x++)
+    {
+        count += row[x] == state->header.maxIterations;
+    }
+    return count;
+}
+
+static const char *readState(IterationState *state, int fd, const Scene *scene)
+{
+    const StateHeader *header = &state->header;
+    // Limits outside of what the command line takes could not have been saved
+    if (!bmpTransfer(fd, &state->header, sizeof(StateHeader), 0, false) || header->type != STATE_FILE_TYPE ||
+        header->maxIterations < 4 || header->maxIterations > UINT16_MAX)
+        return "State file is not valid";
+    if (header->width != scene->width || header->height != scene->height ||
+        header->minRe != scene->minRe || header->minIm != scene->minIm ||
+        header->spanRe != scene->spanRe || header->spanIm != scene->spanIm)
+        return "State file belongs to a different image size or view";
+
+    size_t pixels = (size_t)header->width * header->height;
+    state->iterations = malloc(pixels * sizeof(uint16_t));
+    state->finalZ = calloc(header->height, sizeof(double *));
+    if (!state->iterations || !state->finalZ)
+        return "Failed to allocate memory for the state";
+    off_t offset = sizeof(StateHeader);
+    if (!bmpTransfer(fd, state->iterations, pixels * sizeof(uint16_t), offset, false))
+        return "State file is truncated";
+    offset += pixels * sizeof(uint16_t);
+    // Final z is only stored for counts at the limit, higher ones would have none to resume from
+    for (size_t i = 0; i < pixels; i++)
+    {
+        if (state->iterations[i] > header->maxIterations)
+            return "State file is not valid";
+    }
+
+    for (uint32_t y = 0; y < header->height; y++)
+    {
+        size_t bytes = countBounded(state, y) * 2 * sizeof(double);
+        if (!bytes)
+            continue;
+        state->finalZ[y] = malloc(bytes);
+        if (!state->finalZ[y])
+            return "Failed to allocate memory for the state";
+        if (!bmpTransfer(fd, state->finalZ[y], bytes, offset, false))
+            return "State file is truncated";
+        offset += bytes;
+    }
+    state->loaded = true;
+    return NULL;
+}
+
+const char *stateLoad(IterationState *state, const char *path, const Scene *scene)
+{
+    *state = (IterationState){.header = {.type = STATE_FILE_TYPE,
+                                         .width = scene->width,
+                                         .height = scene->height,
+                                         .minRe = scene->minRe,
+                                         .minIm = scene->minIm,
+                                         .spanRe = scene->spanRe,
+                                         .spanIm = scene->spanIm}};
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 && errno != ENOENT)
+        return "Failed to access the state file";
+    if (fd >= 0)
+    {
+        const char *error = readState(state, fd, scene);
+        close(fd);
+        if (error)
+            stateRelease(state);
+        return error;
+    }
+
+    size_t pixels = (size_t)scene->width * scene->height;
+    state->iterations = malloc(pixels * sizeof(uint16_t));
+    state->finalZ = calloc(scene->height, sizeof(double *));
+    if (!state->iterations || !state->finalZ)
+    {
+        stateRelease(state);
+        return "Failed to allocate memory for the state";
+    }
+    return NULL;
+}
+
+// The state is written next to the file and renamed over it, so a failed save keeps the previous one
+bool stateSave(const IterationState *state, const char *path)
+{
+    char temporary[PATH_MAX];
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", path) >= (int)sizeof(temporary))
+        return false;
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    size_t pixels = (size_t)state->header.width * state->header.height;
+    bool written = bmpTransfer(fd, (void *)&state->header, sizeof(StateHeader), 0, true) &&
+                   bmpTransfer(fd, state->iterations, pixels * sizeof(uint16_t), sizeof(StateHeader), true);
+    off_t offset = sizeof(StateHeader) + pixels * sizeof(uint16_t);
+    for (uint32_t y = 0; written && y < state->header.height; y++)
+    {
+        size_t bytes = countBounded(state, y) * 2 * sizeof(double);
+        written = bmpTransfer(fd, state->finalZ[y], bytes, offset, true);
+        offset += bytes;
+    }
+    written = written && !fsync(fd);
+    written = !close(fd) && written;
+    if (written && !rename(temporary, path))
+        return true;
+    unlink(temporary);
+    return false;
+}
+
+void stateRelease(IterationState *state)
+{
+    for (uint32_t y = 0; state->finalZ && y < state->header.height; y++)
+    {
+        free(state->finalZ[y]);
+    }
+    free(state->finalZ);
+    free(state->iterations);
+    state->finalZ = NULL;
+    state->iterations = NULL;
+}
@@ -0,0 +1,89 @@
+#include "mandelbrot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int compareSeconds(const void *a, const void *b)
+{
+    double first = *(const double *)a, second = *(const double *)b;
+    return (first > second) - (first < second);
+}
+
+void statsPrint(const RenderStats *stats, const Scene *scene)
+{
+    double pixels = (double)scene->width * scene->height;
+    printf("Rendered in %.6f s, %u threads\n", stats->seconds, (unsigned)stats->threads);
+    printf("Iterations: %llu, %.1f per pixel, %.3f G/s\n", (unsigned long long)stats->iterations, stats->iterations / pixels,
+           stats->seconds > 0 ? stats->iterations / stats->seconds / 1e9 : 0);
+    printf("Pixels at max iterations: %.2f%%\n", 100.0 * stats->bounded / pixels);
+
+    // Whole rows are reported as rows, subdivision and tiled output as tiles
+    bool rows = stats->tileHeight == 1;
+    size_t tiles = (size_t)stats->tilesX * stats->tilesY;
+    double *sorted = malloc(tiles * sizeof(double));
+    if (sorted)
+    {
+        size_t slowest = 0;
+        for (size_t i = 0; i < tiles; i++)
+        {
+            sorted[i] = stats->tileSeconds[i];
+            if (sorted[i] > sorted[slowest])
+                slowest = i;
+        }
+        qsort(sorted, tiles, sizeof(double), compareSeconds);
+        printf("%s time: min %.3f ms, median %.3f ms, max %.3f ms", rows ? "Row" : "Tile", sorted[0] * 1e3, sorted[tiles / 2] * 1e3,
+               sorted[tiles - 1] * 1e3);
+        if (rows)
+            printf(" at row %zu\n", slowest);
+        else
+            printf(" at %zu,%zu\n", slowest % stats->tilesX * stats->tileWidth, slowest / stats->tilesX * stats->tileHeight);
+        free(sorted);
+    }
+
+    for (uint_fast16_t i = 0; i < stats->threads; i++)
+    {
+        printf("Thread %u: %.3f s, %u %s\n", (unsigned)i, stats->threadSeconds[i], (unsigned)stats->threadTiles[i], rows ? "rows" : "tiles");
+    }
+}
+
+bool statsWriteHeatmap(const RenderStats *stats, const char *path, ColorMap colorMap)
+{
+    BmpImage image;
+    if (!stats->cost || !bmpAllocate(&image, stats->costWidth, stats->costHeight, BMP_GRAY8))
+        return false;
+
+    size_t cells = (size_t)stats->costWidth * stats->costHeight;
+    uint64_t maximum = 1;
+    for (size_t i = 0; i < cells; i++)
+    {
+        if (stats->cost[i] > maximum)
+            maximum = stats->cost[i];
+    }
+    // Costs go through the color mapping of the image as counts up to the 16-bit limit
+    for (uint32_t y = 0; y < image.height; y++)
+    {
+        uint8_t *row = bmpRow(&image, y);
+        const uint64_t *cost = stats->cost + (size_t)y * stats->costWidth;
+        for (uint32_t x = 0; x < image.width; x++)
+        {
+            row[x] = colorMap((double)cost[x] / maximum * UINT16_MAX, UINT16_MAX);
+        }
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = fd >= 0 && bmpWrite(fd, &image);
+    if (fd >= 0)
+        written = !close(fd) && written;
+    bmpRelease(&image);
+    return written;
+}
+
+void statsRelease(RenderStats *stats)
+{
+    free(stats->tileSeconds);
+    free(stats->cost);
+    stats->tileSeconds = NULL;
+    stats->cost = NULL;
+}
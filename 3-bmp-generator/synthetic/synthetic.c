@@ -0,0 +1,219 @@
+#include "../../lib/bmp.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Rows are generated and written in chunks of about this size
+#define CHUNK_BYTES (16 << 20)
+#define NOISE_OCTAVES 5
+#define NOISE_CELL 256
+
+typedef void (*Pattern)(BmpImage *rows, uint32_t firstRow, uint32_t height, uint64_t seed);
+
+uint64_t hash(uint64_t value)
+{
+    // splitmix64 finalizer
+    value += 0x9E3779B97F4A7C15;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+    return value ^ (value >> 31);
+}
+
+void uniform(BmpImage *rows, uint32_t firstRow, uint32_t height, uint64_t seed)
+{
+    (void)height;
+
+    for (uint32_t y = 0; y < rows->height; y++)
+    {
+        uint8_t *row = bmpRow(rows, y);
+        uint64_t state = hash(seed ^ ((uint64_t)(firstRow + y) << 32));
+        for (uint32_t x = 0; x < rows->width * 3; x++)
+        {
+            // xorshift64, one byte per step
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            row[x] = state >> 56;
+        }
+    }
+}
+
+void gradient(BmpImage *rows, uint32_t firstRow, uint32_t height, uint64_t seed)
+{
+    (void)seed;
+
+    for (uint32_t y = 0; y < rows->height; y++)
+    {
+        uint8_t *pixel = bmpRow(rows, y);
+        uint32_t globalY = firstRow + y;
+        for (uint32_t x = 0; x < rows->width; x++, pixel += 3)
+        {
+            pixel[0] = (uint64_t)x * 255 / rows->width;
+            pixel[1] = (uint64_t)globalY * 255 / height;
+            pixel[2] = ((uint64_t)x * 255 / rows->width + (uint64_t)globalY * 255 / height) / 2;
+        }
+    }
+}
+
+double lattice(int64_t x, int64_t y, uint64_t seed)
+{
+    return (double)(hash(seed ^ hash(x ^ hash(y))) >> 11) / (1ULL << 53);
+}
+
+double smooth(double t)
+{
+    return t * t * (3 - 2 * t);
+}
+
+// Fractal value noise in [0, 1) along a row, smooth at every scale like photographs tend to be.
+// Lattice rows are blended once per lattice column, so pixels only interpolate horizontally
+void noiseRow(double *values, double *columns, uint32_t width, double y, double cell, uint64_t seed)
+{
+    double amplitude = 0.5;
+    double total = 0;
+    memset(values, 0, width * sizeof(*values));
+
+    for (uint_fast8_t octave = 0; octave < NOISE_OCTAVES; octave++, cell /= 2, amplitude /= 2)
+    {
+        double cellY = floor(y / cell);
+        double ty = smooth(y / cell - cellY);
+        uint32_t lastColumn = (width - 1) / cell + 1;
+        for (uint32_t column = 0; column <= lastColumn; column++)
+        {
+            columns[column] = lattice(column, cellY, seed + octave) * (1 - ty) + lattice(column, cellY + 1, seed + octave) * ty;
+        }
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            double cellX = floor(x / cell);
+            double tx = smooth(x / cell - cellX);
+            uint32_t column = cellX;
+            values[x] += amplitude * (columns[column] * (1 - tx) + columns[column + 1] * tx);
+        }
+        total += amplitude;
+    }
+
+    for (uint32_t x = 0; x < width; x++)
+    {
+        values[x] /= total;
+    }
+}
+
+void noise(BmpImage *rows, uint32_t firstRow, uint32_t height, uint64_t seed)
+{
+    (void)height;
+
+    double *light = malloc(rows->width * sizeof(double));
+    double *tint = malloc(rows->width * sizeof(double));
+    double *columns = malloc((rows->width / (NOISE_CELL >> NOISE_OCTAVES) + 2) * sizeof(double));
+    if (!light || !tint || !columns)
+    {
+        fprintf(stderr, "Failed to allocate memory for noise");
+        exit(1);
+    }
+
+    for (uint32_t y = 0; y < rows->height; y++)
+    {
+        uint8_t *pixel = bmpRow(rows, y);
+        noiseRow(light, columns, rows->width, firstRow + y, NOISE_CELL, seed);
+        // Slowly varying tint on top of the luminance keeps channels correlated
+        noiseRow(tint, columns, rows->width, firstRow + y, NOISE_CELL * 4, ~seed);
+        for (uint32_t x = 0; x < rows->width; x++, pixel += 3)
+        {
+            double shift = (tint[x] - 0.5) / 2;
+            pixel[0] = fmin(fmax(255 * (light[x] - shift), 0), 255);
+            pixel[1] = fmin(fmax(255 * light[x], 0), 255);
+            pixel[2] = fmin(fmax(255 * (light[x] + shift), 0), 255);
+        }
+    }
+
+    free(light);
+    free(tint);
+    free(columns);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 5 && argc != 6)
+    {
+        fprintf(stderr, "The program accepts four or five positional arguments: pattern (random/gradient/noise), image width, height, output path, and optional seed");
+        return 1;
+    }
+
+    Pattern pattern;
+    if (!strcmp(argv[1], "random"))
+        pattern = uniform;
+    else if (!strcmp(argv[1], "gradient"))
+        pattern = gradient;
+    else if (!strcmp(argv[1], "noise"))
+        pattern = noise;
+    else
+    {
+        fprintf(stderr, "Unknown pattern, expected random, gradient or noise");
+        return 1;
+    }
+
+    int64_t width = atoll(argv[2]);
+    int64_t height = atoll(argv[3]);
+    uint64_t seed = argc == 6 ? strtoull(argv[5], NULL, 10) : 1;
+    if (width < 1 || height < 1)
+    {
+        fprintf(stderr, "At least one numerical value is too small");
+        return 1;
+    }
+
+    BmpImage image = {.width = width, .height = height, .format = BMP_BGR24};
+    image.stride = bmpRowLength(image.width, image.format);
+    if (bmpHeadersLength(image.format) + bmpDataLength(&image) > UINT32_MAX)
+    {
+        fprintf(stderr, "Image does not fit into 32-bit bitmap size fields");
+        return 1;
+    }
+
+    int output = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output < 0)
+    {
+        fprintf(stderr, "Failed to access the output file");
+        return 1;
+    }
+
+    uint32_t chunkRows = CHUNK_BYTES / image.stride;
+    if (chunkRows < 1)
+        chunkRows = 1;
+    if (chunkRows > image.height)
+        chunkRows = image.height;
+
+    BmpImage chunk;
+    if (!bmpAllocate(&chunk, image.width, chunkRows, image.format))
+    {
+        fprintf(stderr, "Failed to allocate memory for the image");
+        close(output);
+        return 1;
+    }
+
+    BmpHeaders headers;
+    bmpInitHeaders(&headers, &image);
+    bool written = bmpWriteHeaders(output, &headers, image.format);
+
+    for (uint32_t y = 0; written && y < image.height; y += chunkRows)
+    {
+        BmpImage rows = bmpRows(&chunk, 0, image.height - y < chunkRows ? image.height - y : chunkRows);
+        pattern(&rows, y, image.height, seed);
+        written = bmpWritePixels(output, headers.file.bfOffBits + (off_t)y * image.stride, &rows);
+    }
+
+    bmpRelease(&chunk);
+    close(output);
+
+    if (!written)
+    {
+        fprintf(stderr, "Failed to write the output file");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include "bench.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+double benchNow(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double difference = *(const double *)a - *(const double *)b;
+    return (difference > 0) - (difference < 0);
+}
+
+void benchSummarize(double *seconds, size_t repetitions, BenchSummary *summary)
+{
+    double mean = 0, variance = 0;
+    for (size_t r = 0; r < repetitions; r++)
+    {
+        mean += seconds[r] / repetitions;
+    }
+    for (size_t r = 0; r < repetitions; r++)
+    {
+        variance += (seconds[r] - mean) * (seconds[r] - mean) / repetitions;
+    }
+    qsort(seconds, repetitions, sizeof(double), compareDoubles);
+    summary->median = seconds[repetitions / 2];
+    summary->minimum = seconds[0];
+    summary->deviation = mean > 0 ? sqrt(variance) / mean : 0;
+}
+
+double *benchSizes(char *const arguments[], size_t count, const double *defaults, size_t defaultCount, size_t *sizeCount)
+{
+    *sizeCount = count ? count : defaultCount;
+    double *sizes = malloc(*sizeCount * sizeof(double));
+    if (!sizes)
+        return NULL;
+    if (!count)
+        memcpy(sizes, defaults, defaultCount * sizeof(double));
+    for (size_t i = 0; i < count; i++)
+    {
+        sizes[i] = atof(arguments[i]);
+    }
+    return sizes;
+}
@@ -0,0 +1,23 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+
+// Times of the repetitions of a single benchmark case
+typedef struct BenchSummary
+{
+    double median;
+    double minimum;
+    // Standard deviation relative to the mean
+    double deviation;
+} BenchSummary;
+
+// Monotonic wall clock in seconds
+double benchNow(void);
+// Sorts the times and summarizes them
+void benchSummarize(double *seconds, size_t repetitions, BenchSummary *summary);
+// Sizes in megapixels from the command line, or a copy of the defaults when there are none.
+// Returns NULL when out of memory, the caller frees the array
+double *benchSizes(char *const arguments[], size_t count, const double *defaults, size_t defaultCount, size_t *sizeCount);
+
+#endif
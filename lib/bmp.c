@@ -0,0 +1,182 @@
+#include "bmp.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+uint_fast8_t bmpBitCount(BmpFormat format)
+{
+    return format == BMP_GRAY8 ? 8 : 24;
+}
+
+size_t bmpRowLength(uint32_t width, BmpFormat format)
+{
+    return ((size_t)bmpBitCount(format) * width + 31) / 32 * 4;
+}
+
+size_t bmpDataLength(const BmpImage *image)
+{
+    return bmpRowLength(image->width, image->format) * image->height;
+}
+
+size_t bmpHeadersLength(BmpFormat format)
+{
+    return BMP_FILE_HEADER + BMP_INFO_HEADER + (format == BMP_GRAY8 ? BMP_PALETTE : 0);
+}
+
+bool bmpTransfer(int fd, void *buffer, size_t bytes, off_t offset, bool writing)
+{
+    uint8_t *position = buffer;
+    while (bytes > 0)
+    {
+        ssize_t done = writing ? pwrite(fd, position, bytes, offset) : pread(fd, position, bytes, offset);
+        // Pipes have no offsets, data is expected to come in order there
+        if (done < 0 && errno == ESPIPE)
+            done = writing ? write(fd, position, bytes) : read(fd, position, bytes);
+        if (done <= 0)
+            return false;
+        position += done;
+        bytes -= done;
+        offset += done;
+    }
+    return true;
+}
+
+bool bmpReadHeaders(int fd, BmpHeaders *headers)
+{
+    return bmpTransfer(fd, headers, sizeof(*headers), 0, false);
+}
+
+const char *bmpValidate(const BmpHeaders *headers, BmpImage *image)
+{
+    if (headers->file.bfType != BMP_FILE_TYPE)
+        return "Input file is not a bitmap";
+    if (headers->info.biSize < BMP_INFO_HEADER || headers->info.biCompression != 0)
+        return "Only uncompressed bitmaps are supported";
+    if (headers->info.biBitCount != 8 && headers->info.biBitCount != 24)
+        return "Only 8-bit and 24-bit bitmaps are supported";
+    if (headers->info.biWidth < 1 || headers->info.biHeight == 0)
+        return "Bitmap has no pixels";
+
+    *image = (BmpImage){.width = headers->info.biWidth,
+                        .height = headers->info.biHeight < 0 ? -(int64_t)headers->info.biHeight : headers->info.biHeight,
+                        .format = headers->info.biBitCount == 8 ? BMP_GRAY8 : BMP_BGR24,
+                        .topDown = headers->info.biHeight < 0};
+    image->stride = bmpRowLength(image->width, image->format);
+
+    if (headers->file.bfOffBits < sizeof(*headers))
+        return "Pixel data overlaps the headers";
+    return NULL;
+}
+
+BmpImage bmpRows(const BmpImage *image, uint32_t first, uint32_t count)
+{
+    BmpImage rows = *image;
+    rows.base = bmpRow(image, first);
+    rows.height = count;
+    return rows;
+}
+
+bool bmpAllocate(BmpImage *image, uint32_t width, uint32_t height, BmpFormat format)
+{
+    *image = (BmpImage){.width = width, .height = height, .format = format};
+    image->stride = bmpRowLength(width, format);
+    // Zeroed so that padding never needs to be written
+    image->base = calloc(height, image->stride);
+    return image->base != NULL;
+}
+
+void bmpRelease(BmpImage *image)
+{
+    free(image->base);
+    image->base = NULL;
+}
+
+bool bmpMap(BmpImage *image, int fd, off_t offset, bool writable)
+{
+    // Mappings start at a page boundary
+    off_t aligned = offset & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+    size_t length = bmpDataLength(image) + (offset - aligned);
+
+    if (writable && ftruncate(fd, offset + bmpDataLength(image)))
+        return false;
+
+    void *mapping = mmap(NULL, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, aligned);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    image->base = (uint8_t *)mapping + (offset - aligned);
+    image->stride = bmpRowLength(image->width, image->format);
+    return true;
+}
+
+void bmpUnmap(BmpImage *image, off_t offset)
+{
+    off_t aligned = offset & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+    munmap(image->base - (offset - aligned), bmpDataLength(image) + (offset - aligned));
+    image->base = NULL;
+}
+
+void bmpInitHeaders(BmpHeaders *headers, const BmpImage *image)
+{
+    size_t offset = bmpHeadersLength(image->format);
+    size_t data = bmpDataLength(image);
+
+    *headers = (BmpHeaders){
+        .file = {.bfType = BMP_FILE_TYPE, .bfSize = offset + data, .bfOffBits = offset},
+        .info = {.biSize = BMP_INFO_HEADER,
+                 .biWidth = image->width,
+                 .biHeight = image->topDown ? -(LONG)image->height : (LONG)image->height,
+                 .biPlanes = 1,
+                 .biBitCount = bmpBitCount(image->format),
+                 .biSizeImage = data,
+                 .biXPelsPerMeter = BMP_PIXELS_PER_METRE,
+                 .biYPelsPerMeter = BMP_PIXELS_PER_METRE,
+                 .biClrUsed = image->format == BMP_GRAY8 ? BMP_PALETTE_COLORS : 0}};
+}
+
+void bmpGrayscalePalette(uint8_t *palette)
+{
+    // Blue, green, red and a reserved zero byte per entry
+    for (uint_fast16_t value = 0; value < BMP_PALETTE_COLORS; value++)
+    {
+        palette[BMP_PALETTE_BYTES * value] = value;
+        palette[BMP_PALETTE_BYTES * value + 1] = value;
+        palette[BMP_PALETTE_BYTES * value + 2] = value;
+        palette[BMP_PALETTE_BYTES * value + 3] = 0;
+    }
+}
+
+bool bmpWriteHeaders(int fd, const BmpHeaders *headers, BmpFormat format)
+{
+    uint8_t buffer[sizeof(*headers) + BMP_PALETTE];
+    memcpy(buffer, headers, sizeof(*headers));
+    if (format == BMP_GRAY8)
+        bmpGrayscalePalette(buffer + sizeof(*headers));
+    return bmpTransfer(fd, buffer, bmpHeadersLength(format), 0, true);
+}
+
+bool bmpWritePixels(int fd, off_t offset, const BmpImage *image)
+{
+    size_t rowLength = bmpRowLength(image->width, image->format);
+    if (image->stride == rowLength)
+        return bmpTransfer(fd, image->base, rowLength * image->height, offset, true);
+
+    for (uint32_t y = 0; y < image->height; y++)
+    {
+        if (!bmpTransfer(fd, bmpRow(image, y), rowLength, offset + (off_t)y * rowLength, true))
+            return false;
+    }
+    return true;
+}
+
+bool bmpWrite(int fd, const BmpImage *image)
+{
+    BmpHeaders headers;
+    bmpInitHeaders(&headers, image);
+    return bmpWriteHeaders(fd, &headers, image->format) &&
+           bmpWritePixels(fd, headers.file.bfOffBits, image);
+}
@@ -0,0 +1,106 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define BMP_FILE_TYPE 0x4D42
+#define BMP_FILE_HEADER 14
+#define BMP_INFO_HEADER 40
+#define BMP_PALETTE_COLORS 256
+#define BMP_PALETTE_BYTES 4
+#define BMP_PALETTE (BMP_PALETTE_COLORS * BMP_PALETTE_BYTES)
+#define BMP_PIXELS_PER_METRE 11812
+
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+
+// Packed to match the file layout, fields are little-endian like the host
+typedef struct __attribute__((packed)) tagBITMAPFILEHEADER
+{
+    WORD bfType;
+    DWORD bfSize;
+    WORD bfReserved1;
+    WORD bfReserved2;
+    DWORD bfOffBits;
+} BITMAPFILEHEADER;
+
+typedef struct __attribute__((packed)) tagBITMAPINFOHEADER
+{
+    DWORD biSize;
+    LONG biWidth;
+    LONG biHeight;
+    WORD biPlanes;
+    WORD biBitCount;
+    DWORD biCompression;
+    DWORD biSizeImage;
+    LONG biXPelsPerMeter;
+    LONG biYPelsPerMeter;
+    DWORD biClrUsed;
+    DWORD biClrImportant;
+} BITMAPINFOHEADER;
+
+// Both headers as they lie at the start of the file
+typedef struct __attribute__((packed)) BmpHeaders
+{
+    BITMAPFILEHEADER file;
+    BITMAPINFOHEADER info;
+} BmpHeaders;
+
+typedef enum BmpFormat
+{
+    BMP_GRAY8,
+    BMP_BGR24
+} BmpFormat;
+
+// Pixel rows in memory: mapped from a file, read into a buffer or rendered
+typedef struct BmpImage
+{
+    // First row in memory, which is the bottom one unless the image is top-down
+    uint8_t *base;
+    size_t stride;
+    uint32_t width;
+    uint32_t height;
+    BmpFormat format;
+    bool topDown;
+} BmpImage;
+
+static inline uint8_t *bmpRow(const BmpImage *image, uint32_t y)
+{
+    return image->base + y * image->stride;
+}
+
+uint_fast8_t bmpBitCount(BmpFormat format);
+// Bytes per row including padding to a multiple of 4
+size_t bmpRowLength(uint32_t width, BmpFormat format);
+size_t bmpDataLength(const BmpImage *image);
+// Headers followed by palette when the format has one
+size_t bmpHeadersLength(BmpFormat format);
+
+// Full transfer at the given offset, retrying partial reads and writes
+bool bmpTransfer(int fd, void *buffer, size_t bytes, off_t offset, bool writing);
+
+bool bmpReadHeaders(int fd, BmpHeaders *headers);
+// Describes pixel data of a parsed file, returns an error message when it is not supported
+const char *bmpValidate(const BmpHeaders *headers, BmpImage *image);
+
+// View over rows of another image, sharing its memory
+BmpImage bmpRows(const BmpImage *image, uint32_t first, uint32_t count);
+bool bmpAllocate(BmpImage *image, uint32_t width, uint32_t height, BmpFormat format);
+void bmpRelease(BmpImage *image);
+// Maps pixel data at the given file offset, shared and writable when requested
+bool bmpMap(BmpImage *image, int fd, off_t offset, bool writable);
+void bmpUnmap(BmpImage *image, off_t offset);
+
+void bmpInitHeaders(BmpHeaders *headers, const BmpImage *image);
+void bmpGrayscalePalette(uint8_t *palette);
+// Headers and palette in a single write
+bool bmpWriteHeaders(int fd, const BmpHeaders *headers, BmpFormat format);
+// Rows are coalesced into a single write when they are contiguous
+bool bmpWritePixels(int fd, off_t offset, const BmpImage *image);
+bool bmpWrite(int fd, const BmpImage *image);
+
+#endif